@@ -7,12 +7,19 @@
 
 #include "randomlineaccess.h"
 #include "bloom.h"
+#include "fprmeasure.h"
+#include "planner.h"
+#include "filtercodec.h"
+#include "querystream.h"
+#include "hyperloglog.h"
+#include "exactmembership.h"
+#include "tabler.h"
 
 HashFunction HashMonster::hashFunctions[HashMonster::hashFunctionCount] = {
         HashMonster::builtIn,   HashMonster::djb2, HashMonster::sdbm
 };
 
-hash HashMonster::builtIn(std::string key)
+hash HashMonster::builtIn(const std::string& key)
 {
         std::tr1::hash<std::string> str_hash;   // On *nix and VS2010
         return (hash) str_hash(key);
@@ -20,7 +27,7 @@ hash HashMonster::builtIn(std::string key)
 
 // djb2 by Dan Bernstein
 // http://www.cse.yorku.ca/~oz/hash.html
-hash HashMonster::djb2(std::string key)
+hash HashMonster::djb2(const std::string& key)
 {
         const unsigned char* str = reinterpret_cast<const unsigned char*>(key.c_str());
         hash local_hash = 5381;
@@ -34,7 +41,7 @@ hash HashMonster::djb2(std::string key)
 
 // sdbm (public domain, used in gawk)
 // http://www.cse.yorku.ca/~oz/hash.html
-hash HashMonster::sdbm(std::string key)
+hash HashMonster::sdbm(const std::string& key)
 {
         const unsigned char* str = reinterpret_cast<const unsigned char*>(key.c_str());
         hash local_hash = 0;
@@ -46,71 +53,256 @@ hash HashMonster::sdbm(std::string key)
         return local_hash;
 }
 
+// MurmurHash3's 64-bit finalizer. tr1::hash makes no promise about how well
+// its high bits are mixed, and on some platforms it is only 32 bits wide.
+unsigned long long HashMonster::wideHash(const std::string& key)
+{
+        return mix(builtIn(key));
+}
+
+unsigned long long HashMonster::mix(unsigned long long h)
+{
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+}
+
+// Kirsch and Mitzenmacher: probe i is (h1 + i * h2) mod m. h1 is the hash
+// and h2 the same hash with its halves swapped, forced odd so that it is
+// never zero; the sums wrap at 2^64, which biases the result negligibly.
+void HashMonster::probeIndices(const std::string& key, int k, hash m,
+                               hash* indices)
+{
+        unsigned long long h1 = wideHash(key);
+        for(int i = 0; i < k; ++i)
+                indices[i] = (hash) (probeHash(h1, i) % m);
+}
+
+// The seeds step by 2^64 / golden ratio, as in Fibonacci hashing; mix() is a
+// bijection, so no two rows of a key share an index by construction.
+void HashMonster::seededIndices(const std::string& key, int k, hash m,
+                                hash* indices)
+{
+        unsigned long long h1 = wideHash(key);
+        for(int i = 0; i < k; ++i)
+                indices[i] = (hash) (mix(h1 + (i + 1) * 0x9e3779b97f4a7c15ULL) % m);
+}
+
+unsigned long long HashMonster::probeHash(unsigned long long wide_hash, int i)
+{
+        unsigned long long h2 = (wide_hash >> 32 | wide_hash << 32) | 1;
+        return wide_hash + i * h2;
+}
+
+const int BloomFilter::MAX_HASH_COUNT;
+
 // If user specified bitarray_length or active_hashes_count are larger
-// than allowed for by the nature and number of implemented hash functions,
-// the constructor creates a Bloom Filter with the maximum largest
-// bitarray_length and/or active_hashes_count possible and notifies the user.
-BloomFilter::BloomFilter(int bitarray_length, int active_hashes_count)
-                : bitarray(bitarray_length, false),
+// than allowed (for the latter, MAX_HASH_COUNT), the constructor creates a
+// Bloom Filter with the maximum largest bitarray_length and/or
+// active_hashes_count possible and notifies the user.
+BloomFilter::BloomFilter(hash bitarray_length, int active_hashes_count,
+                         FilterLayout layout, const AllocationPolicy& policy)
+                : bitarray(PageAllocator<bitword>(policy)),
                   bitarray_length_(bitarray_length),
-                  active_hashes_count_(active_hashes_count)
+                  active_hashes_count_(active_hashes_count),
+                  layout_(layout),
+                  block_count_(0)
+{
+        initialize();
+}
+
+// Builds the filter a FilterPlanner recommended. The plan never exceeds
+// MAX_HASH_COUNT, so nothing should be clamped.
+BloomFilter::BloomFilter(const FilterPlan& plan,
+                         const AllocationPolicy& policy)
+                : bitarray(PageAllocator<bitword>(policy)),
+                  bitarray_length_(plan.bitarray_length),
+                  active_hashes_count_(plan.hashcount),
+                  layout_(plan.layout),
+                  block_count_(0)
+{
+        initialize();
+}
+
+// Validates the settings shared by both constructors and allocates the bit
+// array. A BLOCKED filter is rounded up to a whole number of blocks.
+void BloomFilter::initialize()
 {
-        // 
-        if(bitarray_length > MAX_HASH)
+        if(bitarray_length_ / BITS_PER_WORD >= bitarray.max_size())
         {
-                std::cout << "Supplied bit array length " << bitarray_length
+                hash max_length = (hash) (bitarray.max_size() - 1) *
+                                                        BITS_PER_WORD;
+                std::cout << "Supplied bit array length " << bitarray_length_
                           << " is longer than the maximum allowed "
-                          << MAX_HASH << " bits. Using the maximum length."
-                          << std::endl;
-                bitarray_length_ = MAX_HASH;
+                          << max_length
+                          << " bits. Using the maximum length." << std::endl;
+                bitarray_length_ = max_length;
         }
 
         if(bitarray_length_ == 0)
                 throw std::invalid_argument("A Bit Array is required to have at least one bit.");
 
-        if(active_hashes_count_ > HashMonster::hashFunctionCount)
+        if(active_hashes_count_ > MAX_HASH_COUNT)
         {
                 std::cout << "Supplied hash function count "
                           << active_hashes_count_ << " is larger than "
-                          << HashMonster::hashFunctionCount
-                          << ", the number of hash functions implemented. "
-                          << "Using all hash functions instead." << std::endl;
-                active_hashes_count_ = HashMonster::hashFunctionCount;
+                          << MAX_HASH_COUNT << ". Using " << MAX_HASH_COUNT
+                          << " instead." << std::endl;
+                active_hashes_count_ = MAX_HASH_COUNT;
         }
 
         if(active_hashes_count_ == 0)
                 throw std::invalid_argument("A Bloom Filter requires at least one hash function to operate.");
 
+        if(layout_ == LAYOUT_BLOCKED)
+        {
+                block_count_ = (bitarray_length_ + BLOOM_BLOCK_BITS - 1) /
+                                                        BLOOM_BLOCK_BITS;
+                bitarray_length_ = block_count_ * BLOOM_BLOCK_BITS;
+        }
+
+        // All zero; on a fresh mapping no page is touched (see PageAllocator).
+        bitarray.resize((bitarray_length_ + BITS_PER_WORD - 1) / BITS_PER_WORD);
+
+        checkpoint_.byte_offset = 0;
+        checkpoint_.line_count = 0;
+        checkpoint_.fingerprint = EMPTY_FINGERPRINT;
         return;
 }
 
+// The copy is built with the original's already validated settings, so
+// nothing is clamped or reported twice. Copying the words is the first
+// touch of the new pages, which places them as policy asks.
+BloomFilter* BloomFilter::replicate(const AllocationPolicy& policy) const
+{
+        BloomFilter* copy = new BloomFilter(bitarray_length_,
+                                            active_hashes_count_,
+                                            layout_, policy);
+        std::copy(bitarray.begin(), bitarray.end(), copy->bitarray.begin());
+        copy->checkpoint_ = checkpoint_;
+        return copy;
+}
+
+// Maps the i-th hash of a key onto a bit. In the BLOCKED layout the first
+// hash also picks the key's block (remembered in block_start); its quotient
+// rather than its remainder places the first bit so the two choices are not
+// correlated.
+hash BloomFilter::probeIndex(int i, hash key_hash, hash* block_start) const
+{
+        if(layout_ == LAYOUT_STANDARD)
+                return key_hash % bitarray_length_;
+
+        if(i == 0)
+        {
+                *block_start = (key_hash % block_count_) * BLOOM_BLOCK_BITS;
+                return *block_start + (key_hash / block_count_) %
+                                                        BLOOM_BLOCK_BITS;
+        }
+        return *block_start + key_hash % BLOOM_BLOCK_BITS;
+}
+
+// Returns the i-th hash of key, computing them in order: first the hash
+// functions, then probes derived from the first one, whose value is kept in
+// *first (and its wideHash() in *wide) by the calls which compute them.
+hash BloomFilter::keyHash(int i, const std::string& key, hash* first,
+                          unsigned long long* wide)
+{
+        if(i < HashMonster::hashFunctionCount)
+        {
+                hash key_hash = HashMonster::hashFunctions[i](key);
+                if(i == 0)
+                        *first = key_hash;
+                return key_hash;
+        }
+        if(i == HashMonster::hashFunctionCount)
+                *wide = HashMonster::mix(*first);
+        return (hash) HashMonster::probeHash(*wide, i);
+}
+
 // Iterates through hash function list to find and set bits associated with key.
-void BloomFilter::load(std::string key)
+void BloomFilter::load(const std::string& key)
 {
         // for each hash, set relevant bits
 
+        hash block_start = 0;
+        hash first = 0;
+        unsigned long long wide = 0;
+        for(int i = 0; i < active_hashes_count_; ++i)
+        {
+                hash hash_index = probeIndex(i, keyHash(i, key, &first, &wide),
+                                             &block_start);
+                bitarray[hash_index / BITS_PER_WORD] |=
+                                bitword(1) << (hash_index % BITS_PER_WORD);
+        }
+}
+
+void BloomFilter::loadHashes(const hash* key_hashes)
+{
+        hash block_start = 0;
+        unsigned long long wide =
+                        active_hashes_count_ > HashMonster::hashFunctionCount ?
+                        HashMonster::mix(key_hashes[0]) : 0;
         for(int i = 0; i < active_hashes_count_; ++i)
         {
-                hash hash_index = HashMonster::hashFunctions[i](key) %
-                                                        bitarray_length_;
-                bitarray[hash_index] = true;
+                hash key_hash = i < HashMonster::hashFunctionCount ?
+                                key_hashes[i] :
+                                (hash) HashMonster::probeHash(wide, i);
+                hash hash_index = probeIndex(i, key_hash, &block_start);
+                bitarray[hash_index / BITS_PER_WORD] |=
+                                bitword(1) << (hash_index % BITS_PER_WORD);
         }
 }
 
 // Iterates through hash function list to check if bits associated with the key
-// (via the hash function) are set. If any bit is not set, query returns false.
-bool BloomFilter::query(std::string value)
+// (via the hash function) are set. If any bit is not set, query returns false
+// without computing the remaining hashes.
+bool BloomFilter::query(const std::string& value) const
 {
-        bool is_member = true;
+        hash block_start = 0;
+        hash first = 0;
+        unsigned long long wide = 0;
         for(int i = 0; i < active_hashes_count_; ++i)
         {
-                hash hash_index = HashMonster::hashFunctions[i](value) %
-                                                        bitarray_length_;
-                if(bitarray[hash_index] == false)
-                        is_member = false;
+                hash hash_index = probeIndex(i,
+                                        keyHash(i, value, &first, &wide),
+                                        &block_start);
+                if((bitarray[hash_index / BITS_PER_WORD] >>
+                    (hash_index % BITS_PER_WORD) & 1) == 0)
+                        return false;
         }
 
-        return is_member;
+        return true;
+}
+
+// An accessor for the (possibly clamped) bit array length.
+hash BloomFilter::getBitarrayLength() const
+{
+        return bitarray_length_;
+}
+
+// An accessor for the (possibly clamped) number of hash functions in use.
+int BloomFilter::getActiveHashesCount() const
+{
+        return active_hashes_count_;
+}
+
+// An accessor for the bit layout chosen at construction.
+FilterLayout BloomFilter::getLayout() const
+{
+        return layout_;
+}
+
+const TrainingCheckpoint& BloomFilter::getCheckpoint() const
+{
+        return checkpoint_;
+}
+
+void BloomFilter::setCheckpoint(const TrainingCheckpoint& checkpoint)
+{
+        checkpoint_ = checkpoint;
 }
 
 // Uses rand() to select an ascii character in the range ['A', '~').
@@ -230,21 +422,29 @@ void testValidEntries(RandomLineAccessInterface*  dictionary,
         int failures = 0;       // incremented when bloom doesn't recognize entry
                                 // (should never ever happen)
 
-        // obtain sample_size # of random entries:
+        // obtain sample_size # of random entries, fetched in one batch:
+
+        if(sample_size > 0 && dictionary->getLineCount() == 0)
+                throw std::invalid_argument("No Valid Dictionary Entries to Test.");
+
+        std::vector<int> line_numbers(sample_size);
+        for(int i = 0; i < sample_size; ++i)
+                line_numbers[i] = rand() % dictionary->getLineCount();
+
+        LineBatch sample;
+        dictionary->getlines(line_numbers.data(), sample_size, &sample);
 
         for(int i = 0; i < sample_size; ++i)
         {
-                if(dictionary->getLineCount() == 0)
-                        throw std::invalid_argument("No Valid Dictionary Entries to Test.");
-                int randint = rand() % dictionary->getLineCount();
+                std::string entry = sample[i].str();
 
                 // test membership
 
-                if(bloom->query(dictionary->getline(randint)))
+                if(bloom->query(entry))
                 {
                         // record success in successes counter & valid_entries
 
-                        valid_entries[successes++] = dictionary->getline(randint);
+                        valid_entries[successes++] = entry;
 
                 }
                 else
@@ -277,7 +477,8 @@ void testValidEntries(RandomLineAccessInterface*  dictionary,
 void testInvalidEntries(RandomLineAccessInterface*   dictionary,
                         std::string*        valid_entries,
                         int                 sample_size,
-                        BloomFilter*        bloom)
+                        BloomFilter*        bloom,
+                        ExactMembershipService* exact)
 {
         int successes = 0;        // Incremented each time the bloom
                                   // filter recognizes the dictionary entry.
@@ -292,15 +493,14 @@ void testInvalidEntries(RandomLineAccessInterface*   dictionary,
                 if(bloom->query(valid_entries[i]))
                 {
                         successes++;
-                        //if(!dictionary->query(valid_entries[i]))
-                        //        false_positives++;    // SLOW
+                        if(!exact->query(valid_entries[i]))
+                                false_positives++;
                 }
         }
 
         std::cout << "Invalid Entries:\t" << successes << " / " << sample_size
-                  << " tested positive." << std::endl;
-                  //<< " tested positive. (False Positives: " << false_positives
-                  //<< ")" << std::endl;    // SLOW
+                  << " tested positive. (False Positives: " << false_positives
+                  << ")" << std::endl;
         return;
 }
 
@@ -308,7 +508,8 @@ void testInvalidEntries(RandomLineAccessInterface*   dictionary,
 // word is tested for membership in the Bloom Filter.
 void testRandomPermutations(RandomLineAccessInterface*   dictionary,
                             int                 sample_size,
-                            BloomFilter*        bloom)
+                            BloomFilter*        bloom,
+                            ExactMembershipService* exact)
 {
         int successes = 0;        // Incremented each time the bloom
                                   // filter recognizes the dictionary entry.
@@ -321,22 +522,24 @@ void testRandomPermutations(RandomLineAccessInterface*   dictionary,
                 if(bloom->query(random_word))
                 {
                         successes++;
-                        //if(!dictionary->query(random_word))   // SLOW
-                        //        false_positives++;
+                        if(!exact->query(random_word))
+                                false_positives++;
                 }
         }
 
         std::cout << "5 chr random words:\t" << successes << " / "
-                  << sample_size << " tested positive." << std::endl;
-                  //<< sample_size << " tested positive. (False Positives: "
-                  //<< false_positives << ")" << std::endl; // SLOW
+                  << sample_size << " tested positive. (False Positives: "
+                  << false_positives << ")" << std::endl;
         return;
 }
 
 // Ensures enough entries are present in the training dictionary (and that
-// the training dictionary exists at all). Returns number of entries.
-int countKeysAndVerifyDictionaryBigEnough(const char* DICTIONARY_FILE,
-                                          const int sample_size)
+// the training dictionary exists at all). Returns the estimated number of
+// distinct entries, which is what the filters must be sized for.
+int hashAndVerifyDictionaryBigEnough(const char* DICTIONARY_FILE,
+                                     const int sample_size,
+                                     unsigned long long prefix_bytes,
+                                     HashedDictionary* hashed)
 {
         // Makes sure training dictionary is present
 
@@ -359,43 +562,237 @@ int countKeysAndVerifyDictionaryBigEnough(const char* DICTIONARY_FILE,
                 exit(-1);
         }
 
-        int key_count = RandomLineAccessInterface::countLines(&dictionary);
         dictionary.close();
+        hashDictionary(DICTIONARY_FILE, hashed, prefix_bytes);
 
         // Notify user if too few words in training dictionary
 
-        if(key_count == 0)
+        if(hashed->line_count == 0)
         {
                 std::cout << "Training dictionary must contain at least one word.\n";
                 exit(-1);
         }
-        else if(key_count < sample_size)
+        else if(hashed->line_count < sample_size)
                 std::cout << "There are fewer training entries than "
                              "random samples to test.\n(Adjust with "
                              "`const int sample_size`.) Entries will "
                              "be tested more than once.\n\n";
 
-        return key_count;
+        int key_count = (int) (hashed->distinct_keys + 0.5);
+        return key_count > 0 ? key_count : 1;
 }
 
 // Opens a training dictionary and loads each entry into the Bloom Filter.
+// Training always starts from the top of the file; the filter's checkpoint
+// is reset first so that it records everything loaded here.
 void train(const char* DICTIONARY_FILE, BloomFilter* bloom)
 {
-        std::ifstream dictionary(DICTIONARY_FILE);
-        std::string line;
-        while(std::getline(dictionary, line))
+        TrainingCheckpoint start;
+        start.byte_offset = 0;
+        start.line_count = 0;
+        start.fingerprint = EMPTY_FINGERPRINT;
+        bloom->setCheckpoint(start);
+        trainIncremental(DICTIONARY_FILE, bloom);
+}
+
+// Reads dictionary from offset start in large binary blocks and calls
+// visit(line) for every line, reusing one string. Lines end at '\n' only; on
+// Windows the '\r' that text mode would have removed is stripped. A final
+// line without a line break is visited too. With max_bytes > 0, reading
+// stops after the block which passes start + max_bytes, and the line it
+// ends inside is not visited. Returns the offset just after the last line
+// break visited, counting complete lines into *line_count.
+template <class Visitor>
+static unsigned long long forEachLine(std::ifstream* dictionary,
+                                      unsigned long long start,
+                                      unsigned long long max_bytes,
+                                      long long* line_count,
+                                      Visitor visit)
+{
+        dictionary->clear();
+        dictionary->seekg((std::streamoff) start);
+
+        const size_t block_size = size_t(1) << 20;
+        std::vector<char> block(block_size);
+        std::string line;       // reused for every key
+        std::string partial;    // a line split across two blocks
+        unsigned long long consumed = start;
+        bool truncated = false;
+
+        while(*dictionary)
         {
-                bloom->load(line);
+                if(max_bytes > 0 && consumed - start >= max_bytes)
+                {
+                        truncated = true;
+                        break;
+                }
+
+                dictionary->read(&block[0], block_size);
+                size_t got = (size_t) dictionary->gcount();
+                if(got == 0)
+                        break;
+                consumed += got;
+
+                size_t begin = 0;
+                for(;;)
+                {
+                        const char* line_end = static_cast<const char*>(
+                                std::memchr(&block[begin], '\n', got - begin));
+                        if(line_end == NULL)
+                        {
+                                partial.append(&block[begin], got - begin);
+                                break;
+                        }
+
+                        size_t end = line_end - &block[0];
+                        line.assign(partial);
+                        line.append(&block[begin], end - begin);
+                        partial.clear();
+#if defined(_WIN32)
+                        if(!line.empty() && line[line.size() - 1] == '\r')
+                                line.erase(line.size() - 1);
+#endif
+                        visit(line);
+
+                        (*line_count)++;
+                        begin = end + 1;
+                        if(begin == got)
+                                break;
+                }
         }
-        dictionary.close();
+
+        if(!partial.empty() && !truncated)
+                visit(partial);
+        dictionary->clear();
+        return consumed - partial.size();
+}
+
+void visitDictionary(const char* DICTIONARY_FILE,
+                     const std::function<void(const std::string&)>& visit)
+{
+        std::ifstream dictionary(DICTIONARY_FILE, std::ios::binary);
+        if(!dictionary)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                DICTIONARY_FILE
+                                );
+        }
+
+        long long line_count = 0;
+        forEachLine(&dictionary, 0, 0, &line_count, visit);
+}
+
+// Loads every line from the checkpoint onward. A final line without a line
+// break is loaded too (as train() always did) but the checkpoint stops in
+// front of it, so the next retrain loads it again in whatever form it has
+// grown into.
+bool trainIncremental(const char* DICTIONARY_FILE, BloomFilter* bloom)
+{
+        std::ifstream dictionary(DICTIONARY_FILE, std::ios::binary);
+        if(!dictionary)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                DICTIONARY_FILE
+                                );
+        }
+
+        TrainingCheckpoint checkpoint = bloom->getCheckpoint();
+
+        dictionary.seekg(0, std::ios::end);
+        unsigned long long file_size = (unsigned long long) dictionary.tellg();
+        if(checkpoint.byte_offset > 0 &&
+           (checkpoint.byte_offset > file_size ||
+            fingerprintPrefix(&dictionary, checkpoint.byte_offset) !=
+                                        checkpoint.fingerprint))
+                return false;
+
+        checkpoint.byte_offset = forEachLine(&dictionary,
+                        checkpoint.byte_offset, 0, &checkpoint.line_count,
+                        [bloom](const std::string& line) { bloom->load(line); });
+        checkpoint.fingerprint = fingerprintPrefix(&dictionary,
+                                                   checkpoint.byte_offset);
+        bloom->setCheckpoint(checkpoint);
+        return true;
+}
+
+// Every hash function runs once per line here, and never again however many
+// filters are trained. The HyperLogLog reuses builtIn()'s value rather than
+// hashing the line a fourth time.
+void hashDictionary(const char* DICTIONARY_FILE, HashedDictionary* hashed,
+                    unsigned long long prefix_bytes)
+{
+        std::ifstream dictionary(DICTIONARY_FILE, std::ios::binary);
+        if(!dictionary)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                DICTIONARY_FILE
+                                );
+        }
+        dictionary.seekg(0, std::ios::end);
+        unsigned long long file_size = (unsigned long long) dictionary.tellg();
+
+        HyperLogLog distinct;
+        std::vector<hash>* hashes = &hashed->hashes;
+        bool keep_hashes = prefix_bytes == 0 || prefix_bytes >= file_size;
+        hashes->clear();
+
+        long long terminated_lines = 0;
+        long long lines = 0;    // including an unterminated last one
+        unsigned long long read = forEachLine(&dictionary, 0,
+                        keep_hashes ? 0 : prefix_bytes, &terminated_lines,
+                        [&distinct, &lines, hashes, keep_hashes](const std::string& line)
+                        {
+                                ++lines;
+                                hash first = HashMonster::hashFunctions[0](line);
+                                distinct.add(HashMonster::mix(first));
+                                if(!keep_hashes)
+                                        return;
+                                hashes->push_back(first);
+                                for(int i = 1; i < HashMonster::hashFunctionCount; ++i)
+                                        hashes->push_back(HashMonster::hashFunctions[i](line));
+                        });
+
+        hashed->line_count = lines;
+        hashed->distinct_keys = distinct.estimate();
+        hashed->complete = keep_hashes;
+        hashed->checkpoint.byte_offset = read;
+        hashed->checkpoint.line_count = terminated_lines;
+        hashed->checkpoint.fingerprint = fingerprintPrefix(&dictionary, read);
+
+        if(!keep_hashes && read > 0 && read < file_size)
+        {
+                double scale = (double) file_size / (double) read;
+                hashed->distinct_keys *= scale;
+                hashed->line_count = (long long) (hashed->line_count * scale);
+        }
+}
+
+void train(const char* DICTIONARY_FILE, const HashedDictionary& hashed,
+           BloomFilter* bloom)
+{
+        if(!hashed.complete)
+        {
+                train(DICTIONARY_FILE, bloom);
+                return;
+        }
+
+        const int stride = HashMonster::hashFunctionCount;
+        for(size_t i = 0; i < hashed.hashes.size(); i += stride)
+                bloom->loadHashes(&hashed.hashes[i]);
+        bloom->setCheckpoint(hashed.checkpoint);
 }
 
 // Tests a random sample of valid entries, a generated sample of
 // (almost certainly) invalid entries, and random strings for
 // membership using the bloom filter.
-void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size)
+void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size,
+          const HashedDictionary* hashed)
 {
         DenseLineCache dictionary(DICTIONARY_FILE);
+        ExactMembershipService exact(bloom, &dictionary, hashed);
         std::string* valid_entries = new std::string[sample_size];
                                            // Will contain each sampled entry.
 
@@ -406,12 +803,265 @@ void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size)
         testInvalidEntries(&dictionary,
                            valid_entries,  // Strings to modify.
                            sample_size,    // Length of valid_entries.
-                           bloom);
-        testRandomPermutations(&dictionary, sample_size, bloom);
+                           bloom,
+                           &exact);        // Confirms the positives.
+        testRandomPermutations(&dictionary, sample_size, bloom, &exact);
+        printMembershipStatistics(exact.getStatistics());
 
         delete[] valid_entries;
 }
 
+// Query results are accumulated, as in FilterPlanner::calibrate(), so the
+// compiler cannot discard the timed loop. The exact check and the sample of
+// dictionary entries run afterwards and are not timed.
+FilterBenchmark benchmarkFilter(const char* DICTIONARY_FILE,
+                                const HashedDictionary& hashed,
+                                BloomFilter* bloom,
+                                const std::vector<std::string>& probes,
+                                RandomLineAccessInterface* dictionary,
+                                int sample_size)
+{
+        FilterBenchmark result;
+
+        std::chrono::steady_clock::time_point start =
+                        std::chrono::steady_clock::now();
+        train(DICTIONARY_FILE, hashed, bloom);
+        std::chrono::duration<double> train_seconds =
+                        std::chrono::steady_clock::now() - start;
+        result.train_mkeys_per_second = train_seconds.count() > 0 ?
+                        hashed.line_count / train_seconds.count() / 1e6 : 0;
+
+        long long positives = 0;
+        start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < probes.size(); ++i)
+                positives += bloom->query(probes[i]);
+        std::chrono::duration<double, std::nano> query_time =
+                        std::chrono::steady_clock::now() - start;
+        result.query_ns = probes.empty() ? 0 : query_time.count() / probes.size();
+
+        result.bytes_per_key = bloom->getBitarrayLength() / 8.0 /
+                               std::max(hashed.distinct_keys, 1.0);
+
+        ExactMembershipService exact(bloom, dictionary, &hashed);
+        bool* members = new bool[probes.size()];
+        if(!probes.empty())
+                exact.query(&probes[0], (int) probes.size(), members);
+        delete[] members;
+        const MembershipStatistics& statistics = exact.getStatistics();
+        long long negatives = (long long) probes.size() - statistics.members;
+        result.false_positive_rate = negatives > 0 ?
+                        (double) (positives - statistics.members) / negatives : 0;
+
+        // As in testValidEntries(), every sampled entry must be accepted.
+
+        result.false_negatives = 0;
+        if(sample_size > 0 && dictionary->getLineCount() > 0)
+        {
+                std::vector<int> line_numbers(sample_size);
+                for(int i = 0; i < sample_size; ++i)
+                        line_numbers[i] = rand() % dictionary->getLineCount();
+                LineBatch sample;
+                dictionary->getlines(line_numbers.data(), sample_size, &sample);
+                for(int i = 0; i < sample_size; ++i)
+                        result.false_negatives += !bloom->query(sample[i].str());
+        }
+        return result;
+}
+
+// Calibrates a FilterPlanner on this host, asks it for the best filter for
+// key_count keys within budget (bytes when by_memory, otherwise a target
+// false positive rate), then builds, trains and tests that single filter.
+void planTrainAndTest(const char* DICTIONARY_FILE,
+                      const HashedDictionary& hashed, int key_count,
+                      bool by_memory, double budget,
+                      double latency_budget_ns, int sample_size)
+{
+        FilterPlanner planner;
+        planner.calibrate();
+
+        FilterPlan plan = by_memory ?
+                planner.planForMemory(key_count,
+                                      (unsigned long long) budget,
+                                      latency_budget_ns) :
+                planner.planForFalsePositiveRate(key_count, budget,
+                                                 latency_budget_ns);
+        printFilterPlan(plan);
+
+        BloomFilter bloom_filter(plan);
+        train(DICTIONARY_FILE, hashed, &bloom_filter);
+        test(DICTIONARY_FILE, &bloom_filter, sample_size, &hashed);
+}
+
+// Trains the smallest filter with a theoretical false positive rate of
+// target_fpr, writes it compressed to FILTER_FILE and reads it back,
+// reporting the compression ratio and how quickly the bit array was rebuilt.
+void saveFilter(const char* DICTIONARY_FILE, const HashedDictionary& hashed,
+                const char* FILTER_FILE, int key_count, double target_fpr)
+{
+        FilterPlanner planner;
+        FilterPlan plan = planner.planForTransmission(key_count, target_fpr);
+        FilterPlan smallest = planner.planForFalsePositiveRate(key_count,
+                                                               target_fpr);
+        printFilterPlan(plan);
+
+        BloomFilter bloom_filter(plan);
+        train(DICTIONARY_FILE, hashed, &bloom_filter);
+
+        std::ofstream out(FILTER_FILE, std::ios::binary);
+        unsigned long long written = FilterCodec::write(bloom_filter, &out);
+        out.close();
+
+        std::ifstream in(FILTER_FILE, std::ios::binary);
+        std::clock_t start = std::clock();
+        BloomFilter* replica = FilterCodec::read(&in);
+        double seconds = double(std::clock() - start) / CLOCKS_PER_SEC;
+        in.close();
+
+        double raw_bytes = (bloom_filter.getBitarrayLength() + 7) / 8;
+        double smallest_bytes = (smallest.bitarray_length + 7) / 8;
+        std::cout << "Saved " << FILTER_FILE << ":	" << written
+                  << " bytes (" << written / raw_bytes << " of raw, "
+                  << written / smallest_bytes << " of the smallest raw filter"
+                  << " for this rate)" << std::endl;
+        if(seconds > 0)
+                std::cout << "Rebuilt bit array at " << raw_bytes / seconds / 1e9
+                          << " GB/s (including file read)" << std::endl;
+
+        delete replica;
+}
+
+// Loads a filter written by saveFilter(), loads only the lines appended to
+// DICTIONARY_FILE since it was last trained and writes it back. A dictionary
+// which was rewritten rather than appended to is retrained from scratch into
+// a filter with the same m, k and layout.
+int retrainFilter(const char* DICTIONARY_FILE, const char* FILTER_FILE)
+{
+        std::ifstream in(FILTER_FILE, std::ios::binary);
+        if(!in)
+        {
+                std::cerr << "Could not open filter " << FILTER_FILE << std::endl;
+                return -1;
+        }
+        BloomFilter* bloom = FilterCodec::read(&in);
+        in.close();
+
+        long long lines_before = bloom->getCheckpoint().line_count;
+        if(trainIncremental(DICTIONARY_FILE, bloom))
+        {
+                std::cout << "Loaded " << bloom->getCheckpoint().line_count -
+                                          lines_before
+                          << " appended lines." << std::endl;
+        }
+        else
+        {
+                std::cout << DICTIONARY_FILE << " changed since the filter "
+                             "was trained. Retraining from scratch." << std::endl;
+                BloomFilter* fresh = new BloomFilter(bloom->getBitarrayLength(),
+                                                     bloom->getActiveHashesCount(),
+                                                     bloom->getLayout());
+                delete bloom;
+                bloom = fresh;
+                train(DICTIONARY_FILE, bloom);
+        }
+
+        std::ofstream out(FILTER_FILE, std::ios::binary);
+        FilterCodec::write(*bloom, &out);
+        out.close();
+
+        std::cout << "Filter now holds " << bloom->getCheckpoint().line_count
+                  << " lines (" << bloom->getCheckpoint().byte_offset
+                  << " bytes) of " << DICTIONARY_FILE << "." << std::endl;
+        delete bloom;
+        return 0;
+}
+
+// Loads a filter written by saveFilter() and answers membership for every
+// key in KEY_FILE ("-" for stdin), writing the accepted keys (or a bitmap)
+// to stdout. Statistics go to stderr so they never mix with results.
+int queryStream(const char* FILTER_FILE, const char* KEY_FILE, bool bitmap)
+{
+        std::ifstream filter_file(FILTER_FILE, std::ios::binary);
+        if(!filter_file)
+        {
+                std::cerr << "Could not open filter " << FILTER_FILE << std::endl;
+                return -1;
+        }
+        BloomFilter* bloom = FilterCodec::read(&filter_file);
+        filter_file.close();
+
+        std::FILE* keys = std::string(KEY_FILE) == "-" ? stdin :
+                          std::fopen(KEY_FILE, "rb");
+        if(keys == NULL)
+        {
+                std::cerr << "Could not open keys " << KEY_FILE << std::endl;
+                delete bloom;
+                return -1;
+        }
+
+        StreamStatistics statistics = streamQueries(*bloom, keys, stdout,
+                        bitmap ? OUTPUT_BITMAP : OUTPUT_MATCHES);
+        if(keys != stdin)
+                std::fclose(keys);
+        delete bloom;
+
+        // An empty or tiny input can finish within the clock's resolution.
+        double megabytes_per_second = statistics.seconds > 0 ?
+                        statistics.bytes / 1e6 / statistics.seconds : 0;
+        std::cerr << statistics.keys << " keys, " << statistics.matches
+                  << " tested positive, " << megabytes_per_second
+                  << " MB/s" << std::endl;
+        return 0;
+}
+
+// Cell formatters for the sweep's tables.
+static std::string formatFixed(double value, int precision)
+{
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(precision) << value;
+        return out.str();
+}
+
+static std::string formatFixed1(const double& value)
+{
+        return formatFixed(value, 1);
+}
+
+static std::string formatSignificant(const double& value)
+{
+        std::ostringstream out;
+        out << std::setprecision(4) << value;
+        return out.str();
+}
+
+// Prints the tables one after another as aligned text or CSV (separated by
+// blank lines), or as one JSON array.
+static void printTables(Tabler<double>* const* tables, int count,
+                        const std::string& report_format)
+{
+        if(report_format == "json")
+                std::cout << "[";
+        for(int t = 0; t < count; ++t)
+        {
+                if(report_format == "csv")
+                {
+                        std::cout << (t > 0 ? "\n" : "") << tables[t]->format_csv();
+                }
+                else if(report_format == "json")
+                {
+                        std::string json = tables[t]->format_json();
+                        std::cout << (t > 0 ? ",\n" : "")
+                                  << json.substr(0, json.size() - 1);
+                }
+                else
+                {
+                        std::cout << (t > 0 ? "\n" : "");
+                        tables[t]->print();
+                }
+        }
+        if(report_format == "json")
+                std::cout << "]" << std::endl;
+}
+
 // Creates and trains a Bloom Filter and computes its effectiveness using
 // a number of tests; repeatedly for different flavors of Bloom Filter,
 // by iteratively changing the number of hash functions (hashcount) used as
@@ -420,12 +1070,27 @@ void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size)
 //
 // According to http://pages.cs.wisc.edu/~cao/papers/summary-cache/node8.html,
 // hashcount < 3 is required for lenfact == 2. Further constraints on
-// hashcount as a function of lenfact exist, however only three hash functions
-// are currently implemented. Thus we iterate lenfact from 3 on upwards. This
-// is simply a convenient thing to do; other values could've been selected.
+// hashcount as a function of lenfact exist; the sweep tries one hashcount per
+// HashMonster hash function (BloomFilter derives more, up to MAX_HASH_COUNT,
+// for planned filters). Thus we iterate lenfact from 3 on upwards. This is
+// simply a convenient thing to do; other values could've been selected.
 //
 // Seeds the random number generator with the system time.
-int main()
+//
+// Run as `bloom --measure-fpr [probe count]` to replace the sample_size tests
+// with a large scale false positive measurement (see fprmeasure.h).
+// Run as `bloom --plan-fpr <rate> [latency ns]` or
+// `bloom --plan-memory <bytes> [latency ns]` to let FilterPlanner pick a
+// single configuration instead of sweeping lenfact and hashcount.
+// Run as `bloom --save <filter file> [rate]` to write a compressed filter
+// (see filtercodec.h).
+// Run as `bloom --query <filter file> [key file | -] [--bitmap]` to answer
+// membership for a stream of keys; no training dictionary is needed.
+// Run as `bloom --retrain <filter file>` to load only the lines appended to
+// the training dictionary since the saved filter was trained.
+// Append `--sample-prefix <bytes>` to size filters from an estimate over only
+// the start of the dictionary instead of hashing all of it up front.
+int main(int argc, char* argv[])
 {
         // Demonstration Parameters
 
@@ -435,15 +1100,138 @@ int main()
         const int sample_size = 100;            // # of words to test using
                                                 // the Bloom Filter.
 
-        int key_count = countKeysAndVerifyDictionaryBigEnough(DICTIONARY_FILE,
-                                                              sample_size);
+        unsigned long long prefix_bytes = 0;   // 0: hash the whole dictionary
+        std::string report_format = "table";    // or "csv", "json"
+        while(argc > 2)
+        {
+                std::string option = argv[argc - 2];
+                if(option == "--sample-prefix")
+                        prefix_bytes = std::strtoull(argv[argc - 1], NULL, 10);
+                else if(option == "--format")
+                        report_format = argv[argc - 1];
+                else
+                        break;
+                argc -= 2;
+        }
+        if(report_format != "table" && report_format != "csv" &&
+           report_format != "json")
+        {
+                std::cout << "Unknown report format " << report_format
+                          << ". Using table instead." << std::endl;
+                report_format = "table";
+        }
+
+        std::string mode = argc > 1 ? argv[1] : "";
+
+        if(mode == "--query" && argc > 2)
+        {
+                return queryStream(argv[2], argc > 3 ? argv[3] : "-",
+                                   argc > 4 && std::string(argv[4]) == "--bitmap");
+        }
+        if(mode == "--retrain" && argc > 2)
+                return retrainFilter(DICTIONARY_FILE, argv[2]);
+        bool measure_fpr = mode == "--measure-fpr";
+        long long probe_count = 10000000;       // # of probes per filter in
+                                                // measurement mode.
+        if(measure_fpr && argc > 2)
+                probe_count = std::atoll(argv[2]);
+
+        HashedDictionary hashed;
+        int key_count = hashAndVerifyDictionaryBigEnough(DICTIONARY_FILE,
+                                                         sample_size,
+                                                         prefix_bytes,
+                                                         &hashed);
+
+        if((mode == "--plan-fpr" || mode == "--plan-memory") && argc > 2)
+        {
+                srand(random_seed);
+                planTrainAndTest(DICTIONARY_FILE, hashed, key_count,
+                                 mode == "--plan-memory",
+                                 std::atof(argv[2]),
+                                 argc > 3 ? std::atof(argv[3]) : 0,
+                                 sample_size);
+                return 0;
+        }
+
+        if(mode == "--save" && argc > 2)
+        {
+                saveFilter(DICTIONARY_FILE, hashed, argv[2], key_count,
+                           argc > 3 ? std::atof(argv[3]) : 0.01);
+                return 0;
+        }
+
+        // Measurement mode keeps the whole dictionary in memory so positives
+        // can be classified exactly. Its exact count of distinct keys then
+        // replaces the estimate, so that the filters, the theoretical table
+        // and each measurement's own theoretical rate share one n.
+
+        ExactDictionary exact;
+        if(measure_fpr)
+                key_count = (int) loadExactDictionary(DICTIONARY_FILE, &exact);
+
+        // Every filter answers the same probes, so the cells of a table
+        // differ only by the filter's settings.
+
+        srand(random_seed);
+        std::vector<std::string> probes(1 << 18);
+        for(size_t i = 0; i < probes.size(); ++i)
+                probes[i] = randomWord(5);
+
+        // Confirming a table's worth of positives reads many scattered lines
+        // per filter, so this cache keeps several reads in flight.
+
+        const int io_threads = 8;
+        DenseLineCache dictionary(DICTIONARY_FILE, io_threads);
+
+        // One table per measurement, with a row per lenfact and a column
+        // per hashcount.
+
+        Tabler<double> query_table("m/n", "k");
+        Tabler<double> train_table("m/n", "k");
+        Tabler<double> size_table("m/n", "k");
+        Tabler<double> fpr_table("m/n", "k");
+        Tabler<double> theory_table("m/n", "k");
+        Tabler<double> low_table("m/n", "k");      // measurement mode only
+        Tabler<double> high_table("m/n", "k");
+        Tabler<double>* tables[] = {&query_table, &train_table,
+                                    &size_table, &fpr_table, &theory_table,
+                                    &low_table, &high_table};
+        const int max_table_count = sizeof(tables) / sizeof(tables[0]);
+        const int table_count = measure_fpr ? max_table_count :
+                                              max_table_count - 2;
+        query_table.set_title("Query time (ns/query)");
+        train_table.set_title("Loading precomputed hashes (Mkeys/s)");
+        size_table.set_title("Bit array (bytes/key)");
+        fpr_table.set_title(measure_fpr ?
+                            "False positive rate (--measure-fpr)" :
+                            "False positive rate");
+        theory_table.set_title("Theoretical false positive rate");
+        low_table.set_title("False positive rate, 95% interval low");
+        high_table.set_title("False positive rate, 95% interval high");
+        query_table.set_formatter(formatFixed1);
+        train_table.set_formatter(formatFixed1);
+        for(int t = 2; t < max_table_count; ++t)
+                tables[t]->set_formatter(formatSignificant);
+
+        std::vector<std::string> hashcounts;
+        for(int hashcount = 1;
+            hashcount <= HashMonster::hashFunctionCount;
+            ++hashcount)
+                hashcounts.push_back(std::to_string(hashcount));
+        for(int t = 0; t < table_count; ++t)
+                tables[t]->set_column_keys(hashcounts);
 
         // Tries varied settings of lenfact:
-        // Bit array length shall be lenfact multiples of the dictionary length.
+        // Bit array length shall be lenfact multiples of the (estimated,
+        // distinct) dictionary length.
 
+        int false_negative_cells = 0;   // should never ever be nonzero
         for(int lenfact = 3; lenfact < 8; ++lenfact)
         {
-                int bitarray_length = int(lenfact * key_count);
+                hash bitarray_length = hash(lenfact) * key_count;
+                Row<double>* rows[max_table_count];
+                for(int t = 0; t < table_count; ++t)
+                        rows[t] = &tables[t]->add_row(std::to_string(lenfact));
 
                 // Tries varied settings of hashcount:
                 // Bloom Filter shall use hashcount # of hash functions.
@@ -452,23 +1240,50 @@ int main()
                     hashcount <= HashMonster::hashFunctionCount;
                     ++hashcount)
                 {
-                        // tells user what settings we're using
-
-                        std::cout << "lenfact (m/n) = " << lenfact << std::endl
-                                  << "hashcount (k) = " << hashcount << std::endl;
-
-                        // Creates, trains, and tests Bloom Filter; outputs
-                        // test results to stdout.
+                        // Creates, trains, and times the Bloom Filter.
 
                         BloomFilter bloom_filter(bitarray_length, hashcount);
-                        train(DICTIONARY_FILE, &bloom_filter);
+                        FilterBenchmark result = benchmarkFilter(
+                                        DICTIONARY_FILE, hashed, &bloom_filter,
+                                        probes, &dictionary, sample_size);
+                        if(result.false_negatives > 0)
+                        {
+                                std::cerr << "m/n = " << lenfact << ", k = "
+                                          << hashcount << ": "
+                                          << result.false_negatives << " / "
+                                          << sample_size << " dictionary "
+                                          << "entries tested negative. This "
+                                          << "indicates a problem with the "
+                                          << "bloom filter." << std::endl;
+                                false_negative_cells++;
+                        }
 
-                        srand(random_seed);
-                        test(DICTIONARY_FILE, &bloom_filter, sample_size);
+                        rows[0]->add_data(result.query_ns);
+                        rows[1]->add_data(result.train_mkeys_per_second);
+                        rows[2]->add_data(result.bytes_per_key);
+                        rows[4]->add_data(theoreticalFalsePositiveRate(
+                                        bitarray_length, hashcount, key_count));
 
-                        std::cout << std::endl;
+                        if(measure_fpr)
+                        {
+                                FalsePositiveMeasurement measurement =
+                                        measureFalsePositiveRate(&bloom_filter,
+                                                                 exact,
+                                                                 probe_count,
+                                                                 0,
+                                                                 random_seed);
+                                rows[3]->add_data(measurement.rate);
+                                rows[5]->add_data(measurement.interval_low);
+                                rows[6]->add_data(measurement.interval_high);
+                        }
+                        else
+                        {
+                                rows[3]->add_data(result.false_positive_rate);
+                        }
                 }
         }
 
-        return 0;
+        printTables(tables, table_count, report_format);
+
+        return false_negative_cells > 0 ? 1 : 0;
 }
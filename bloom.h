@@ -13,30 +13,57 @@
  * This header contains additional information in the categories below.
  *
  ** PROGRAM OUTPUT
- * Program output should look as follows:
- *  lenfact (m/n) = 6
- *  hashcount (k) = 2
- *  Valid Entries:       100 / 100 tested positive.
- *  Invalid Entries:     8 / 100 tested positive.
- *  5 chr random words:  9 / 100 tested positive.
+ * The program tries every combination of two settings and prints one table
+ * per measurement, with a row per lenfact and a column per hashcount:
+ *  Query time (ns/query)
+ *  m/n \ k     1     2     3
+ *        3  34.6  50.2  59.6
+ *        4  32.7  46.1  58.3
+ *      ...
+ * followed in the same layout by "Loading precomputed hashes (Mkeys/s)"
+ * (the second phase of training only, see hashDictionary()), "Bit array
+ * (bytes/key)", "False positive rate" and "Theoretical false positive
+ * rate". With --format csv or --format json
+ * after any other arguments, the tables are written as CSV (separated by
+ * blank lines) or as one JSON array instead, to keep and diff between runs.
  *
- * The first two entries describe settings used on the Bloom Filter. lenfact
- * is how many times longer the bit array is longer than the training
+ * lenfact is how many times longer the bit array is longer than the training
  * dictionary length. hashcount is the number of hash functions used.
  * (These are called "m/n" and "k" respectively on a very useful site
  *  I recommend visiting: pages.cs.wisc.edu/~cao/papers/summary-cache/node8.html)
  *
- * The second three entries describe the results of tests performed on the
- * Bloom Filter. The Bloom Filter should recognize 100% of the entries
- * it was trained on (the first test). It should recognize a few invalid
- * entries and a few random entries. False positives should reduce with
- * higher lenfact and hashcount.
+ * Every filter answers the same random five character probes, one thread,
+ * for the query times. Positives are confirmed exactly (see
+ * exactmembership.h), so probes which are real dictionary entries do not
+ * count as false positives. False positives should reduce with higher
+ * lenfact and hashcount; query time grows with hashcount.
+ *
+ * Planning mode tests the single filter it builds instead:
+ *  Valid Entries:       100 / 100 tested positive.
+ *  Invalid Entries:     8 / 100 tested positive. (False Positives: 8)
+ *  5 chr random words:  9 / 100 tested positive. (False Positives: 9)
+ *  Exact checks:        17 queries, 0 rejected by the filter, 17 by
+ *                       fingerprint, 0 cached, 0 read from the dictionary
+ *                       (0 members)
+ * The Bloom Filter should recognize 100% of the entries it was trained on
+ * (the first test), and a few invalid and random entries. The last entry
+ * says which tier of the exact check settled each positive.
  *
  ** COMPILATION NOTES (SEE ALSO: KNOWN BUGS AND COMPILER IDS)
  *  * Compiling using VS2010 works fine (even with line 164, see below.
  *  * Compiling from command line (VS2010 sp1) required using /EHsc option and commenting
  *    out line bloom.cpp:164 (after building with VS2010 gui, I could put line 164 back in)
  *  * Compiling with g++, replace #include<functional> with #include<tr1/function>.
+ *  * The false positive measurement mode (fprmeasure.cpp) uses std::thread and
+ *    needs a C++11 compiler; compile time filters (staticbloom.h) need C++14,
+ *    and staticbloom.cpp checks them when the program is built:
+ *      g++ -std=c++14 -O2 -pthread bloom.cpp randomlineaccess.cpp fprmeasure.cpp \
+ *          planner.cpp filtercodec.cpp pagealloc.cpp replicatedfilter.cpp \
+ *          filterhandle.cpp querystream.cpp linecache.cpp quotientfilter.cpp \
+ *          slidingfilter.cpp countmin.cpp hyperloglog.cpp exactmembership.cpp \
+ *          tabler.cpp staticbloom.cpp
+ *  * Huge page and NUMA placement (pagealloc.cpp) is Linux only; elsewhere
+ *    bit arrays silently use the default allocator.
  *
  ** KNOWN BUGS
  * * tellg()/getline()
@@ -53,20 +80,58 @@
  *
  ** ABSTRACT PROGRAM FLOW
  * SETUP
- *  Calculate dictionary word count directly from file.
- *  Use word count to pick bitarray length and optimal (or sub-optimal)
+ *  Read the dictionary once, hashing every entry with every hash function
+ *    into memory and estimating the number of distinct entries (HyperLogLog).
+ *  Use the estimate to pick bitarray length and optimal (or sub-optimal)
  *    hash key count.
  *
  * INITIALIZATION
  *  Instantiate Bloom Filter class
- *  For every dictionary entry, load it into the Bloom Filter.
+ *  For every dictionary entry, load its stored hashes into the Bloom Filter.
  *
- * TEST USAGE
- *  Test a random sample of trained entries for membership. Report result.
- *  Generate and test a set of invalid entries. Report Result.
- *  Generate random combinations and test for membership. Report Result.
+ *  With --sample-prefix <bytes> after any other arguments, only that much of
+ *  the dictionary is read to estimate its distinct entries, nothing is kept
+ *  in memory, and each filter is trained by reading the file.
+ *
+ * BENCHMARK
+ *  Time loading the precomputed hashes. Time a query of each random probe.
+ *    Confirm the positives exactly. Query a sample of dictionary entries,
+ *    reporting any the filter rejects on stderr (the program then exits
+ *    with status 1). Record the results in the tables' cells.
+ *  After every setting has been tried, print the tables.
  * Done.
  *
+ * MEASUREMENT MODE (bloom --measure-fpr [probe count])
+ *  Instead of the random probes above, stream millions of probes through
+ *  each filter on every core, checking positives against an exact copy of
+ *  the dictionary, for the false positive rate table. Two more tables give
+ *  the low and high ends of its 95% confidence interval.
+ *
+ * PLANNING MODE (bloom --plan-fpr <rate> | --plan-memory <bytes> [latency ns])
+ *  Instead of sweeping lenfact and hashcount, time each layout and hash count
+ *  on this host, let FilterPlanner pick the smallest filter meeting the
+ *  target rate (or the most accurate filter fitting the memory budget) within
+ *  the latency budget, then train and test that filter: test a random
+ *  sample of trained entries, a set of invalid entries and random
+ *  combinations for membership, and report the results.
+ *
+ * SAVE MODE (bloom --save <filter file> [rate])
+ *  Train a filter planned for the given false positive rate (default 0.01)
+ *  and write it with FilterCodec, which Golomb-Rice codes the gaps between
+ *  set bits so sparse filters are cheap to ship to other machines. The plan
+ *  trades memory for a sparse bit array (fewer hashes, up to 8 times the
+ *  bits) so the file comes out smaller than the smallest raw filter.
+ *
+ * QUERY MODE (bloom --query <filter file> [key file | -] [--bitmap])
+ *  Load a saved filter and answer membership for newline delimited keys from
+ *  a file or stdin, using every core. Accepted keys (or a bitmap with one bit
+ *  per key) are written to stdout in input order.
+ *
+ * RETRAIN MODE (bloom --retrain <filter file>)
+ *  Saved filters remember how far through the dictionary they were trained.
+ *  When the dictionary has only grown by appending, load just the new lines
+ *  into the saved filter instead of retraining it from the first line.
+ *
  ** ON BLOOM FILTERS AND USAGE
  * This Bloom Filter requires a training dictionary. Here is the preferred
  * dictionary for you to use:
@@ -88,15 +153,12 @@
  ** FUTURE DIRECTIONS
  * This project needs an enhanced user interface. It needs better data
  * presentation and a way to change settings without recompiling the program.
- *  * test functions can return a table object, which prints afterwards
+ *  * test functions can return a table object, as the sweep does (tabler.h)
  *  * can make interactive or create parameters file
  *
- * DenseLineCache::query() needs to be changed to a more efficient solution:
- * current implementation is a last minute addition to check if any mutated
- * entries (testInvalidEntries) are still in the training dictionary.
- *  * can implement binary search if check ordered at RandomLineAccessInterface
- *    construction. Would integrate well with a sparse implementation of
- *    RandomLineAccessInterface. Can store sparse values in memory to speed search.
+ * DenseLineCache::query() still scans the whole file. test() no longer uses
+ * it: ExactMembershipService confirms positives against a sorted fingerprint
+ * table instead, reading only the lines whose fingerprint matches.
  *
  ** ACKNOWLEDGEMENTS FOR ALL THIRD PARTY FUNCTIONS
  * Two functions and a macro from third parties were used in this demonstration:
@@ -114,14 +176,20 @@
 #include <iostream>     /* cout, ios_base::failure */
 #include <string>       /* string */
 #include <cstdlib>      /* rand, srand */
+#include <cstring>      /* memchr */
 #include <ctime>        /* time */
-#include <vector>       /* vector<bool> */
+#include <vector>       /* vector */
+#include <algorithm>    /* copy */
 #include <tr1/functional>   /* hash<std::string>. g++ specific (Win, OS X) */
-#include <functional>   /* hash<std::string>. VS2010 specific **/
+#include <functional>   /* function; hash<std::string>. VS2010 specific **/
 #include <limits>       /* numeric_limits */
 #include <cmath>        /* floor */
 #include <stdexcept>    /* invalid_argument */
+#include <chrono>       /* steady_clock */
+#include <sstream>      /* ostringstream */
+#include <iomanip>      /* setprecision */
 #include "macros.h"
+#include "pagealloc.h"
 #include "randomlineaccess.h"
 
 #ifndef BLOOM_H_
@@ -131,14 +199,57 @@
 /****** typedefs ******/
 
 typedef unsigned long hash;                 // Return type for hash functions.
-typedef hash (*HashFunction)(std::string);  // Function pointer to functions
-                                            // of form: hash fxn(string).
+typedef hash (*HashFunction)(const std::string&);  // Function pointer to
+                                                   // functions of form:
+                                                   // hash fxn(const string&).
 const hash MAX_HASH = std::numeric_limits<hash>::max();
 
+typedef unsigned long long bitword;         // Storage unit of a bit array.
+const int BITS_PER_WORD = 64;
+typedef std::vector<bitword, PageAllocator<bitword> > BitArray;
+
+// How a Bloom Filter spreads a key's bits over its bit array. STANDARD lets
+// every hash land anywhere in the array (one cache miss per hash); BLOCKED
+// keeps all of a key's bits inside one BLOOM_BLOCK_BITS sized block (one
+// cache miss per key) at the price of a slightly higher false positive rate.
+enum FilterLayout
+{
+        LAYOUT_STANDARD,
+        LAYOUT_BLOCKED
+};
+const int FILTER_LAYOUT_COUNT = 2;
+const hash BLOOM_BLOCK_BITS = 512;      // one 64 byte cache line
+
 
 /****** Forward Declarations ******/
 
 class BloomFilter;
+struct FilterPlan;      // planner.h
+class ExactMembershipService;   // exactmembership.h
+
+// How much of an append-only training dictionary a filter has consumed.
+// byte_offset always sits just after a line break; fingerprint is the content
+// fingerprint of the first byte_offset bytes (see fingerprintPrefix() in
+// randomlineaccess.h).
+struct TrainingCheckpoint
+{
+        unsigned long long byte_offset;
+        long long line_count;
+        unsigned long long fingerprint;
+};
+
+// A training dictionary read once: the hashes of every line by every one of
+// HashMonster's functions, so any number of filters can be trained without
+// reading the file again, plus the estimated number of distinct lines to
+// size them with. Costs hashFunctionCount hashes of memory per line.
+struct HashedDictionary
+{
+        std::vector<hash> hashes;       // hashFunctionCount per line
+        long long line_count;           // extrapolated if !complete
+        double distinct_keys;           // HyperLogLog estimate
+        bool complete;                  // false: a sampled prefix, no hashes
+        TrainingCheckpoint checkpoint;  // of a filter trained on every line
+};
 
 // Returns a random ascii character in the range ['A', '~').
 const char randomChar();
@@ -167,25 +278,107 @@ void testValidEntries(RandomLineAccessInterface* dictionary,
 void testInvalidEntries(RandomLineAccessInterface*   dictionary,
                         std::string*        valid_entries,
                         int                 sample_size,
-                        BloomFilter*        bloom);
+                        BloomFilter*        bloom,
+                        ExactMembershipService* exact);
 
 // Generates sample_size # of random five character words. Each entry
 // is tested for membership using BloomFilter bloom.
 void testRandomPermutations(RandomLineAccessInterface*   dictionary,
                             int                 sample_size,
-                            BloomFilter*        bloom);
+                            BloomFilter*        bloom,
+                            ExactMembershipService* exact);
 
-// Verifies that the user supplied a large enough dictionary and
-// returns the number of entries in it.
-int countKeysAndVerifyDictionaryBigEnough(const char* DICTIONARY_FILE,
-                                          const int sample_size);
+// Verifies that the user supplied a large enough dictionary, hashing it
+// into hashed on the way (see hashDictionary()), and returns the estimated
+// number of distinct entries in it.
+int hashAndVerifyDictionaryBigEnough(const char* DICTIONARY_FILE,
+                                     const int sample_size,
+                                     unsigned long long prefix_bytes,
+                                     HashedDictionary* hashed);
+
+// The first phase of a two-phase build: reads DICTIONARY_FILE once, storing
+// every line's hashes and estimating the number of distinct lines. With
+// prefix_bytes > 0 only about that many bytes are read and no hashes are
+// stored; the counts are extrapolated to the whole file, which assumes the
+// prefix is representative (a file repeating itself is overestimated). Throws
+// std::ios_base::failure if the file cannot be read.
+void hashDictionary(const char* DICTIONARY_FILE, HashedDictionary* hashed,
+                    unsigned long long prefix_bytes = 0);
 
 // Loads contents of a dictionary file into the Bloom Filter.
 void train(const char* DICTIONARY_FILE, BloomFilter* bloom);
 
+// Calls visit(line) for every line of DICTIONARY_FILE, split exactly as
+// train() splits them, so that other structures agree with the filter on
+// what a key is. Throws std::ios_base::failure if the file cannot be opened.
+void visitDictionary(const char* DICTIONARY_FILE,
+                     const std::function<void(const std::string&)>& visit);
+
+// The second phase: loads every line of a complete HashedDictionary into the
+// Bloom Filter without reading the file, or falls back to
+// train(DICTIONARY_FILE, bloom) for a sampled one.
+void train(const char* DICTIONARY_FILE, const HashedDictionary& hashed,
+           BloomFilter* bloom);
+
+// Loads only the lines appended to DICTIONARY_FILE since bloom's training
+// checkpoint, then advances the checkpoint. Returns false, loading nothing,
+// if the file no longer starts with the bytes the checkpoint describes (it
+// was rewritten or truncated, as far as the sampled fingerprint can tell);
+// the filter must then be trained from scratch.
+bool trainIncremental(const char* DICTIONARY_FILE, BloomFilter* bloom);
+
+// Speed, size and accuracy of one trained filter, as the sweep in main()
+// reports them.
+struct FilterBenchmark
+{
+        double train_mkeys_per_second;  // millions of lines loaded per second
+                                        // from hashed (no reading or hashing)
+        double query_ns;                // per query, on one thread
+        double bytes_per_key;           // bit array bytes per distinct entry
+        double false_positive_rate;     // over the probes not in the dictionary
+        int false_negatives;            // sampled entries rejected (should
+                                        // never ever be nonzero)
+};
+
+// Trains bloom from hashed and times it, then times one query per probe.
+// Positives are confirmed by an ExactMembershipService over dictionary, so
+// probes which are genuine entries do not count as false positives. Finally
+// sample_size random dictionary entries are queried, counting rejections.
+FilterBenchmark benchmarkFilter(const char* DICTIONARY_FILE,
+                                const HashedDictionary& hashed,
+                                BloomFilter* bloom,
+                                const std::vector<std::string>& probes,
+                                RandomLineAccessInterface* dictionary,
+                                int sample_size);
+
 // Runs a series of tests on the input Bloom Filter (testValidEntries,
-// testInvalidEntries, and testRandomPermutations).
-void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size);
+// testInvalidEntries, and testRandomPermutations). Positives are confirmed
+// by an ExactMembershipService, built from hashed when it is complete.
+void test(const char* DICTIONARY_FILE, BloomFilter* bloom, int sample_size,
+          const HashedDictionary* hashed = NULL);
+
+// Lets a host-calibrated FilterPlanner choose m, k and the layout for
+// key_count keys (budget is bytes if by_memory, else a target false positive
+// rate), then trains and tests the planned filter.
+void planTrainAndTest(const char* DICTIONARY_FILE,
+                      const HashedDictionary& hashed, int key_count,
+                      bool by_memory, double budget,
+                      double latency_budget_ns, int sample_size);
+
+// Trains a filter planned for target_fpr by planForTransmission() and writes
+// it, compressed with FilterCodec, to FILTER_FILE.
+void saveFilter(const char* DICTIONARY_FILE, const HashedDictionary& hashed,
+                const char* FILTER_FILE, int key_count, double target_fpr);
+
+// Brings the filter saved in FILTER_FILE up to date with the lines appended
+// to DICTIONARY_FILE since it was trained, and saves it again. Returns
+// main()'s exit status.
+int retrainFilter(const char* DICTIONARY_FILE, const char* FILTER_FILE);
+
+// Streams newline delimited keys from KEY_FILE ("-" => stdin) through the
+// filter saved in FILTER_FILE, writing accepted keys (or, with bitmap, one
+// bit per key) to stdout. Returns main()'s exit status.
+int queryStream(const char* FILTER_FILE, const char* KEY_FILE, bool bitmap);
 
 /****** Class Contracts *****/
 
@@ -202,9 +395,40 @@ class HashMonster
                 static const int hashFunctionCount = 3;
                 static HashFunction hashFunctions[hashFunctionCount];
 
-                static hash builtIn(std::string key);
-                static hash djb2(std::string key);
-                static hash sdbm(std::string key);
+                static hash builtIn(const std::string& key);
+                static hash djb2(const std::string& key);
+                static hash sdbm(const std::string& key);
+
+                // builtIn() run through a 64-bit finalizer, so that every
+                // bit, including the top ones, depends on the whole key.
+                static unsigned long long wideHash(const std::string& key);
+                static unsigned long long mix(unsigned long long h);  // the finalizer
+
+                // Fills indices[0] to indices[k - 1] with positions in
+                // [0, m) from one wideHash() of key (double hashing), for
+                // structures needing more probes than hashFunctionCount or
+                // probing several tables with the same indices. A key
+                // matching a member's two hashes mod m matches all k, a
+                // false positive floor of roughly k * n / m^2 over the
+                // textbook rate (Kirsch and Mitzenmacher). Measured with
+                // 100000 keys it is lost in the noise at m/n = 9.6, k = 7,
+                // and 2% of a 1e-6 target at k = 20; with 10000 keys, 15%
+                // of that target. Tiny filters with low targets should
+                // remix instead (see staticbloom.h), and rows which must
+                // be independent use seededIndices().
+                static void probeIndices(const std::string& key, int k,
+                                         hash m, hash* indices);
+
+                // Like probeIndices(), but index i is mix() of wideHash(key)
+                // offset by a seed of its own, so the k indices behave as k
+                // independent hashes rather than points on one line.
+                static void seededIndices(const std::string& key, int k,
+                                          hash m, hash* indices);
+
+                // The i-th double hashing probe of a wideHash(), before it
+                // is reduced to a position.
+                static unsigned long long probeHash(unsigned long long wide_hash,
+                                                    int i);
         protected:
                 HashMonster();  // Disallows instantiation
         private:
@@ -224,16 +448,60 @@ class HashMonster
 //          bloomFilter BloomFilter(10,3);
 //          bloomFilter.load("hello");
 //          std::cout << bloomFilter.query("hello");
+// A filter can also be built from a FilterPlanner plan (see planner.h):
+//          BloomFilter bloomFilter(planner.planForFalsePositiveRate(n, 0.01));
+// Large filters can ask for huge pages or NUMA placement (see pagealloc.h):
+//          BloomFilter bloomFilter(m, k, LAYOUT_STANDARD,
+//                                  AllocationPolicy(HUGE_PAGES_1GB,
+//                                                   NUMA_INTERLEAVE));
+// The first k hashes are HashMonster's own functions. Any beyond
+// hashFunctionCount are double hashing probes (HashMonster::probeHash()) of
+// the first one, so k can reach its optimum, ln 2 * m/n, for any budget.
 class BloomFilter
 {
         public:
-                BloomFilter(int bitarray_length, int active_hashes_count);
-                void load(std::string key);     // train to recognize key
-                bool query(std::string value);  // ask if value was loaded
+                static const int MAX_HASH_COUNT = 24;
+
+                BloomFilter(hash bitarray_length, int active_hashes_count,
+                            FilterLayout layout = LAYOUT_STANDARD,
+                            const AllocationPolicy& policy = AllocationPolicy());
+                explicit BloomFilter(const FilterPlan& plan,
+                                     const AllocationPolicy& policy = AllocationPolicy());
+
+                // Returns a copy of this filter whose bit array is allocated
+                // according to policy, e.g. bound to another NUMA node. It is
+                // the user's responsibility to delete the copy.
+                BloomFilter* replicate(const AllocationPolicy& policy) const;
+
+                void load(const std::string& key);  // train to recognize key
+
+                // Same as load(key), given key_hashes[i] =
+                // HashMonster::hashFunctions[i](key) for every one of them
+                // (the probes beyond those are derived from key_hashes[0]).
+                void loadHashes(const hash* key_hashes);
+                bool query(const std::string& value) const;  // ask if value was loaded
+                hash getBitarrayLength() const;     // m
+                int getActiveHashesCount() const;   // k
+                FilterLayout getLayout() const;
+
+                // Progress through an append-only training dictionary (see
+                // trainIncremental()). Starts at the beginning of the file.
+                const TrainingCheckpoint& getCheckpoint() const;
+                void setCheckpoint(const TrainingCheckpoint& checkpoint);
         private:
-                std::vector<bool> bitarray;
+                void initialize();
+                hash probeIndex(int i, hash key_hash, hash* block_start) const;
+                static hash keyHash(int i, const std::string& key,
+                                    hash* first, unsigned long long* wide);
+
+                friend class FilterCodec;  // reads and fills bitarray
+
+                BitArray bitarray;         // bit i is bit i % 64 of word i / 64
                 hash bitarray_length_;     // <-- must not be modified after
                 int active_hashes_count_;  // <-- instantiation
+                FilterLayout layout_;      // <--
+                hash block_count_;         // BLOCKED layout only
+                TrainingCheckpoint checkpoint_;
                 DISALLOW_COPY_AND_ASSIGN(BloomFilter);
 };
 
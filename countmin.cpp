@@ -0,0 +1,251 @@
+/*******************************************************************************
+ * Count-Min sketch
+ *
+ * Documentation available in countmin.h.
+*******************************************************************************/
+
+#include <algorithm>    /* min, sort */
+#include <climits>      /* UINT_MAX */
+#include <stdexcept>    /* invalid_argument */
+#include <thread>       /* thread, hardware_concurrency */
+#include "countmin.h"
+
+const int CountMinSketch::MAX_DEPTH;
+
+CountMinSketch::CountMinSketch(hash width, int depth,
+                               int heavy_hitter_capacity)
+                : width_(width),
+                  depth_(depth),
+                  total_count_(0),
+                  heavy_hitter_capacity_(heavy_hitter_capacity > 0 ?
+                                         heavy_hitter_capacity : 0),
+                  smallest_candidate_(0)
+{
+        if(width_ == 0)
+                throw std::invalid_argument("A Count-Min sketch requires at least one counter per row.");
+        if(depth_ <= 0)
+                throw std::invalid_argument("A Count-Min sketch requires at least one row.");
+
+        if(depth_ > MAX_DEPTH)
+        {
+                std::cout << "Supplied depth " << depth_
+                          << " is larger than " << MAX_DEPTH
+                          << ". Using " << MAX_DEPTH << " instead."
+                          << std::endl;
+                depth_ = MAX_DEPTH;
+        }
+
+        counters_.assign(width_ * depth_, 0);
+}
+
+// Conservative update: every counter is raised to at most the new estimate
+// (the old minimum plus count), never beyond. Counters already above it
+// carry other keys' counts and are left alone. Returns the new estimate.
+unsigned int CountMinSketch::update(const hash* indices, unsigned int count)
+{
+        unsigned int* cells[MAX_DEPTH];
+        unsigned int smallest = UINT_MAX;
+        for(int row = 0; row < depth_; ++row)
+        {
+                cells[row] = &counters_[row * width_ + indices[row]];
+                smallest = std::min(smallest, *cells[row]);
+        }
+
+        unsigned int target = smallest > UINT_MAX - count ? UINT_MAX :
+                                                            smallest + count;
+        for(int row = 0; row < depth_; ++row)
+        {
+                if(*cells[row] < target)
+                        *cells[row] = target;
+        }
+        total_count_ += count;
+        return target;
+}
+
+void CountMinSketch::load(const std::string& key, unsigned int count)
+{
+        hash indices[MAX_DEPTH];
+        HashMonster::seededIndices(key, depth_, width_, indices);
+        unsigned int estimate = update(indices, count);
+        if(heavy_hitter_capacity_ > 0)
+                offerCandidate(key, estimate);
+}
+
+// Updates stay in input order: conservative update reads the counters it
+// writes, so two updates of the same key cannot be combined blindly.
+void CountMinSketch::load(const std::string* keys, int n)
+{
+        scratch_.resize((size_t) n * depth_);
+        for(int j = 0; j < n; ++j)
+                HashMonster::seededIndices(keys[j], depth_, width_,
+                                           &scratch_[(size_t) j * depth_]);
+
+        for(int j = 0; j < n; ++j)
+        {
+                unsigned int estimate = update(&scratch_[(size_t) j * depth_], 1);
+                if(heavy_hitter_capacity_ > 0)
+                        offerCandidate(keys[j], estimate);
+        }
+}
+
+unsigned int CountMinSketch::estimate(const std::string& key) const
+{
+        hash indices[MAX_DEPTH];
+        HashMonster::seededIndices(key, depth_, width_, indices);
+
+        unsigned int smallest = UINT_MAX;
+        for(int row = 0; row < depth_; ++row)
+                smallest = std::min(smallest, counters_[row * width_ + indices[row]]);
+        return smallest;
+}
+
+void CountMinSketch::estimate(const std::string* keys, int n,
+                              unsigned int* estimates) const
+{
+        std::vector<hash> indices((size_t) n * depth_);
+        for(int j = 0; j < n; ++j)
+        {
+                HashMonster::seededIndices(keys[j], depth_, width_,
+                                           &indices[(size_t) j * depth_]);
+                estimates[j] = UINT_MAX;
+        }
+
+        std::vector<unsigned int> row_values(n);
+        for(int row = 0; row < depth_; ++row)
+        {
+                const unsigned int* counters = &counters_[row * width_];
+                for(int j = 0; j < n; ++j)
+                        row_values[j] = counters[indices[(size_t) j * depth_ + row]];
+                for(int j = 0; j < n; ++j)
+                        estimates[j] = std::min(estimates[j], row_values[j]);
+        }
+}
+
+// Saturating add without branches, so the loop vectorizes: a sum smaller
+// than an addend has wrapped, and the comparison's all-ones mask pins it to
+// UINT_MAX.
+static void addCounters(unsigned int* into, const unsigned int* from,
+                        size_t count)
+{
+        for(size_t i = 0; i < count; ++i)
+        {
+                unsigned int sum = into[i] + from[i];
+                into[i] = sum | (0u - (unsigned int) (sum < into[i]));
+        }
+}
+
+void CountMinSketch::merge(const CountMinSketch& other, int thread_count)
+{
+        if(other.width_ != width_ || other.depth_ != depth_)
+                throw std::invalid_argument("Count-Min sketches of different dimensions cannot be merged.");
+
+        if(thread_count <= 0)
+                thread_count = (int) std::thread::hardware_concurrency();
+        if(thread_count <= 0)
+                thread_count = 1;
+
+        // Chunks of at least a megabyte; smaller ones are not worth a thread.
+        size_t total = counters_.size();
+        size_t min_chunk = (size_t(1) << 20) / sizeof(unsigned int);
+        size_t chunks = std::min((size_t) thread_count,
+                                 (total + min_chunk - 1) / min_chunk);
+        if(chunks <= 1)
+        {
+                addCounters(&counters_[0], &other.counters_[0], total);
+        }
+        else
+        {
+                size_t chunk = (total + chunks - 1) / chunks;
+                std::vector<std::thread> workers;
+                for(size_t start = 0; start < total; start += chunk)
+                        workers.push_back(std::thread(addCounters,
+                                        &counters_[start],
+                                        &other.counters_[start],
+                                        std::min(chunk, total - start)));
+                for(size_t t = 0; t < workers.size(); ++t)
+                        workers[t].join();
+        }
+        total_count_ += other.total_count_;
+
+        if(heavy_hitter_capacity_ > 0)
+        {
+                for(size_t i = 0; i < candidates_.size(); ++i)
+                        candidates_[i].second = estimate(candidates_[i].first);
+                findSmallestCandidate();
+                for(size_t i = 0; i < other.candidates_.size(); ++i)
+                        offerCandidate(other.candidates_[i].first,
+                                       estimate(other.candidates_[i].first));
+        }
+}
+
+// Keeps the heavy_hitter_capacity_ keys with the largest estimates. The
+// smallest candidate is remembered so that the common case, a key which is
+// not a candidate and does not beat the smallest, costs one hash lookup.
+void CountMinSketch::offerCandidate(const std::string& key,
+                                    unsigned int estimate)
+{
+        std::unordered_map<std::string, int>::iterator found =
+                        candidate_index_.find(key);
+        if(found != candidate_index_.end())
+        {
+                candidates_[found->second].second = estimate;
+                if(found->second == smallest_candidate_)
+                        findSmallestCandidate();
+                return;
+        }
+
+        if((int) candidates_.size() < heavy_hitter_capacity_)
+        {
+                candidate_index_[key] = (int) candidates_.size();
+                candidates_.push_back(HeavyHitter(key, estimate));
+                findSmallestCandidate();
+                return;
+        }
+
+        if(estimate <= candidates_[smallest_candidate_].second)
+                return;
+
+        candidate_index_.erase(candidates_[smallest_candidate_].first);
+        candidates_[smallest_candidate_] = HeavyHitter(key, estimate);
+        candidate_index_[key] = smallest_candidate_;
+        findSmallestCandidate();
+}
+
+void CountMinSketch::findSmallestCandidate()
+{
+        smallest_candidate_ = 0;
+        for(size_t i = 1; i < candidates_.size(); ++i)
+        {
+                if(candidates_[i].second < candidates_[smallest_candidate_].second)
+                        smallest_candidate_ = (int) i;
+        }
+}
+
+static bool moreFrequent(const HeavyHitter& a, const HeavyHitter& b)
+{
+        return a.second > b.second;
+}
+
+std::vector<HeavyHitter> CountMinSketch::getHeavyHitters() const
+{
+        std::vector<HeavyHitter> result(candidates_);
+        for(size_t i = 0; i < result.size(); ++i)
+                result[i].second = estimate(result[i].first);
+        std::sort(result.begin(), result.end(), moreFrequent);
+        return result;
+}
+
+hash CountMinSketch::getWidth() const
+{
+        return width_;
+}
+
+int CountMinSketch::getDepth() const
+{
+        return depth_;
+}
+
+unsigned long long CountMinSketch::getTotalCount() const
+{
+        return total_count_;
+}
@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Count-Min sketch
+ *
+ * BloomFilter::load() records that a key was seen but not how often. A
+ * Count-Min sketch keeps depth rows of width counters; each key increments
+ * one counter per row, at the positions HashMonster::seededIndices() picks,
+ * and its frequency is estimated by the smallest of them. Estimates never
+ * fall below the true count and, with width = e / epsilon and
+ * depth = ln(1 / delta), exceed it by more than epsilon * (total count) with
+ * probability at most delta. The bound needs the rows hashed independently:
+ * double hashing (probeIndices()) would not do, since two keys colliding in
+ * one row are then likely to collide in others. seededIndices() remixes one
+ * 64-bit hash per row, so rows are independent unless two keys share all 64
+ * bits. Conservative update (only raising the counters which are at the
+ * minimum) tightens the estimates considerably in practice.
+ *
+ * Each row is its own array, so an update touches depth cache lines.
+ * Packing a key's counters into one line would save those misses, but every
+ * row's position would then follow from the one line chosen, and two keys
+ * sharing a line would share a counter in many rows: the correlation the
+ * bound rules out.
+ *
+ * (Cormode and Muthukrishnan, "An Improved Data Stream Summary: The
+ * Count-Min Sketch and its Applications", 2005; Estan and Varghese, "New
+ * Directions in Traffic Measurement and Accounting", 2002.)
+*******************************************************************************/
+
+#include <string>           /* string */
+#include <unordered_map>    /* unordered_map */
+#include <utility>          /* pair */
+#include <vector>           /* vector */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef COUNT_MIN_H_
+#define COUNT_MIN_H_
+
+typedef std::pair<std::string, unsigned int> HeavyHitter;  // key, estimate
+
+// Counters are 32 bits and saturate instead of wrapping. With
+// heavy_hitter_capacity > 0 the sketch also tracks that many candidate heavy
+// hitters: the keys with the largest estimates seen so far, kept in a
+// bounded table so memory stays fixed. Not thread-safe; shard the stream
+// over several sketches and merge() them instead.
+//      Example usage:
+//          CountMinSketch counts(1 << 16, 4, 100);
+//          counts.load("hello");
+//          counts.estimate("hello");     // >= 1
+//          counts.getHeavyHitters();     // up to 100 most frequent keys
+class CountMinSketch
+{
+        public:
+                static const int MAX_DEPTH = 16;
+
+                // Throws std::invalid_argument if width or depth is zero;
+                // depth is clamped to MAX_DEPTH.
+                CountMinSketch(hash width, int depth,
+                               int heavy_hitter_capacity = 0);
+
+                // Adds count occurrences of key.
+                void load(const std::string& key, unsigned int count = 1);
+
+                // Adds one occurrence of each of keys[0] to keys[n - 1].
+                // Hashes the whole batch before touching any counter.
+                void load(const std::string* keys, int n);
+
+                unsigned int estimate(const std::string& key) const;
+
+                // Sets estimates[i] to estimate(keys[i]). Each row is read
+                // for the whole batch before the next, and the running
+                // minimum is a branch free loop the compiler vectorizes.
+                void estimate(const std::string* keys, int n,
+                              unsigned int* estimates) const;
+
+                // Adds other's counters to these, splitting the counter
+                // array over thread_count threads (<= 0: one per hardware
+                // thread), and merges the heavy hitter candidates. The
+                // result still never underestimates the combined stream,
+                // though it may overestimate a little more than one sketch
+                // loaded with both. Throws std::invalid_argument if the
+                // dimensions differ.
+                void merge(const CountMinSketch& other, int thread_count = 0);
+
+                // The candidates, most frequent first, with fresh estimates.
+                std::vector<HeavyHitter> getHeavyHitters() const;
+
+                hash getWidth() const;
+                int getDepth() const;
+                unsigned long long getTotalCount() const;  // sum of all counts
+        private:
+                unsigned int update(const hash* indices, unsigned int count);
+                void offerCandidate(const std::string& key,
+                                    unsigned int estimate);
+                void findSmallestCandidate();
+
+                std::vector<unsigned int> counters_;    // depth_ rows of width_
+                hash width_;
+                int depth_;
+                unsigned long long total_count_;
+                std::vector<hash> scratch_;     // batch indices
+
+                int heavy_hitter_capacity_;
+                std::vector<HeavyHitter> candidates_;
+                std::unordered_map<std::string, int> candidate_index_;
+                int smallest_candidate_;    // index into candidates_
+                DISALLOW_COPY_AND_ASSIGN(CountMinSketch);
+};
+
+#endif
@@ -0,0 +1,238 @@
+/*******************************************************************************
+ * Exact membership service
+ *
+ * Documentation available in exactmembership.h.
+*******************************************************************************/
+
+#include <algorithm>    /* sort, lower_bound, min */
+#include <cstring>      /* memcmp */
+#include <iostream>     /* cout, endl */
+#include <stdexcept>    /* invalid_argument */
+#include "exactmembership.h"
+
+const int ExactMembershipService::DEFAULT_CACHE_CAPACITY;
+
+ExactMembershipService::ExactMembershipService(const BloomFilter* bloom,
+                                               RandomLineAccessInterface* dictionary,
+                                               const HashedDictionary* hashed,
+                                               int cache_capacity)
+                : bloom_(bloom),
+                  dictionary_(dictionary),
+                  cache_capacity_(cache_capacity > 0 ? cache_capacity : 0)
+{
+        if(bloom_ == NULL)
+                throw std::invalid_argument("An exact membership service requires a Bloom Filter.");
+        if(dictionary_ == NULL)
+                throw std::invalid_argument("An exact membership service requires a dictionary.");
+
+        resetStatistics();
+
+        // A HashedDictionary of some other file would give the wrong line
+        // count, and one of a sampled prefix holds no hashes.
+        const size_t stride = HashMonster::hashFunctionCount;
+        if(hashed != NULL && hashed->complete &&
+           hashed->hashes.size() / stride == (size_t) dictionary_->getLineCount())
+                buildFromHashes(*hashed);
+        else
+                buildFromDictionary();
+
+        std::sort(table_.begin(), table_.end());
+}
+
+// The top half of wideHash(), which is mix() of the builtIn() hash every
+// HashedDictionary already stores.
+unsigned int ExactMembershipService::fingerprint(const std::string& value)
+{
+        return (unsigned int) (HashMonster::wideHash(value) >> 32);
+}
+
+void ExactMembershipService::buildFromHashes(const HashedDictionary& hashed)
+{
+        const size_t stride = HashMonster::hashFunctionCount;
+        size_t lines = hashed.hashes.size() / stride;
+        table_.resize(lines);
+        for(size_t line = 0; line < lines; ++line)
+        {
+                unsigned long long wide = HashMonster::mix(hashed.hashes[line * stride]);
+                table_[line] = (wide >> 32 << 32) | line;
+        }
+}
+
+void ExactMembershipService::buildFromDictionary()
+{
+        const int batch_size = 4096;
+        int line_count = dictionary_->getLineCount();
+        table_.resize(line_count);
+
+        std::vector<int> line_numbers(batch_size);
+        LineBatch batch;
+        for(int start = 0; start < line_count; start += batch_size)
+        {
+                int n = std::min(batch_size, line_count - start);
+                for(int i = 0; i < n; ++i)
+                        line_numbers[i] = start + i;
+                dictionary_->getlines(&line_numbers[0], n, &batch);
+
+                for(int i = 0; i < n; ++i)
+                {
+                        TableEntry line = (TableEntry) (start + i);
+                        table_[line] = ((TableEntry) fingerprint(batch[i].str()) << 32) |
+                                       line;
+                }
+        }
+}
+
+bool ExactMembershipService::needsVerification(const std::string& value,
+                std::vector<TableEntry>::const_iterator* first,
+                std::vector<TableEntry>::const_iterator* last)
+{
+        ++statistics_.queries;
+        if(!bloom_->query(value))
+        {
+                ++statistics_.bloom_rejections;
+                return false;
+        }
+
+        TableEntry key = (TableEntry) fingerprint(value) << 32;
+        *first = std::lower_bound(table_.begin(), table_.end(), key);
+        *last = *first;
+        while(*last != table_.end() && (**last >> 32) == (key >> 32))
+                ++*last;
+        if(*first == *last)
+        {
+                ++statistics_.fingerprint_rejections;
+                return false;
+        }
+
+        if(isKnownFalsePositive(value))
+        {
+                ++statistics_.cache_hits;
+                return false;
+        }
+
+        ++statistics_.verifications;
+        return true;
+}
+
+bool ExactMembershipService::query(const std::string& value)
+{
+        std::vector<TableEntry>::const_iterator first, last;
+        if(!needsVerification(value, &first, &last))
+                return false;
+
+        for(; first != last; ++first)
+        {
+                if(dictionary_->getline((int) (*first & 0xffffffffULL)) == value)
+                {
+                        ++statistics_.members;
+                        return true;
+                }
+        }
+
+        ++statistics_.false_positives;
+        rememberFalsePositive(value);
+        return false;
+}
+
+// Screens the whole batch first, then reads every candidate line at once, so
+// the dictionary sees one sorted, coalesced request instead of a seek per
+// candidate.
+void ExactMembershipService::query(const std::string* values, int n,
+                                   bool* results)
+{
+        std::vector<int> pending;           // values awaiting verification
+        std::vector<int> candidate_start;   // per pending value, into lines
+        std::vector<int> lines;
+        for(int j = 0; j < n; ++j)
+        {
+                results[j] = false;
+                std::vector<TableEntry>::const_iterator first, last;
+                if(!needsVerification(values[j], &first, &last))
+                        continue;
+                pending.push_back(j);
+                candidate_start.push_back((int) lines.size());
+                for(; first != last; ++first)
+                        lines.push_back((int) (*first & 0xffffffffULL));
+        }
+        if(pending.empty())
+                return;
+        candidate_start.push_back((int) lines.size());
+
+        LineBatch batch;
+        dictionary_->getlines(&lines[0], (int) lines.size(), &batch);
+
+        for(size_t p = 0; p < pending.size(); ++p)
+        {
+                const std::string& value = values[pending[p]];
+                for(int c = candidate_start[p]; c < candidate_start[p + 1]; ++c)
+                {
+                        LineView line = batch[c];
+                        if(line.length == value.size() &&
+                           std::memcmp(line.data, value.data(), line.length) == 0)
+                        {
+                                results[pending[p]] = true;
+                                break;
+                        }
+                }
+
+                if(results[pending[p]])
+                {
+                        ++statistics_.members;
+                }
+                else
+                {
+                        ++statistics_.false_positives;
+                        rememberFalsePositive(value);
+                }
+        }
+}
+
+bool ExactMembershipService::isKnownFalsePositive(const std::string& value) const
+{
+        return false_positives_.find(value) != false_positives_.end();
+}
+
+// First in, first out: a false positive queried often is worth keeping, but
+// it is also cheap to verify again, so the cache stays simple.
+void ExactMembershipService::rememberFalsePositive(const std::string& value)
+{
+        if(cache_capacity_ == 0 || !false_positives_.insert(value).second)
+                return;
+        false_positive_order_.push_back(value);
+        if((int) false_positive_order_.size() > cache_capacity_)
+        {
+                false_positives_.erase(false_positive_order_.front());
+                false_positive_order_.pop_front();
+        }
+}
+
+const MembershipStatistics& ExactMembershipService::getStatistics() const
+{
+        return statistics_;
+}
+
+void ExactMembershipService::resetStatistics()
+{
+        statistics_.queries = 0;
+        statistics_.bloom_rejections = 0;
+        statistics_.fingerprint_rejections = 0;
+        statistics_.cache_hits = 0;
+        statistics_.verifications = 0;
+        statistics_.members = 0;
+        statistics_.false_positives = 0;
+}
+
+size_t ExactMembershipService::getTableSize() const
+{
+        return table_.size();
+}
+
+void printMembershipStatistics(const MembershipStatistics& statistics)
+{
+        std::cout << "Exact checks:\t\t" << statistics.queries << " queries, "
+                  << statistics.bloom_rejections << " rejected by the filter, "
+                  << statistics.fingerprint_rejections << " by fingerprint, "
+                  << statistics.cache_hits << " cached, "
+                  << statistics.verifications << " read from the dictionary ("
+                  << statistics.members << " members)" << std::endl;
+}
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Exact membership service
+ *
+ * A Bloom Filter answers "no" exactly and "yes" only probably. Confirming
+ * each "yes" with DenseLineCache::query() scans the whole dictionary, which
+ * is why test() used to skip counting false positives. ExactMembershipService
+ * puts the Bloom Filter in front of three cheaper tiers:
+ *  * a sorted table of 32-bit fingerprints, one per dictionary line, which
+ *    rejects nearly every false positive without touching the file and
+ *    names the few lines a genuine member could be;
+ *  * a small cache of values already confirmed to be false positives;
+ *  * reading those candidate lines from the dictionary and comparing them.
+ * Answers are exact, and since most queries stop at the first or second tier
+ * the throughput stays close to the Bloom Filter's own.
+*******************************************************************************/
+
+#include <deque>            /* deque */
+#include <string>           /* string */
+#include <unordered_set>    /* unordered_set */
+#include <vector>           /* vector */
+#include "macros.h"
+#include "bloom.h"
+#include "randomlineaccess.h"
+
+#ifndef EXACT_MEMBERSHIP_H_
+#define EXACT_MEMBERSHIP_H_
+
+// How often each tier settled a query. Every query is counted in exactly one
+// of bloom_rejections, fingerprint_rejections, cache_hits and verifications;
+// verifications splits into members and false_positives.
+struct MembershipStatistics
+{
+        long long queries;
+        long long bloom_rejections;         // the filter said no
+        long long fingerprint_rejections;   // no line has the fingerprint
+        long long cache_hits;               // a known false positive
+        long long verifications;            // candidate lines were read
+        long long members;
+        long long false_positives;          // read, and none matched
+};
+
+// bloom must have been trained on every line of dictionary. Neither is owned;
+// both must outlive the service. The table costs 8 bytes per line. Members
+// are always confirmed by reading the dictionary, so wrapping it in a
+// CachedLineAccess makes repeated member queries cheap. Not thread-safe.
+//      Example usage:
+//          DenseLineCache dictionary("wordlist.txt");
+//          ExactMembershipService exact(&bloom_filter, &dictionary);
+//          exact.query("hello");           // true only if a line is "hello"
+//          exact.getStatistics().bloom_rejections;
+class ExactMembershipService
+{
+        public:
+                static const int DEFAULT_CACHE_CAPACITY = 1024;
+
+                // Builds the fingerprint table from hashed when it is the
+                // complete HashedDictionary of the same file, and otherwise
+                // by reading every line of dictionary. cache_capacity bounds
+                // the false positive cache (0 disables it). Throws
+                // std::invalid_argument if bloom or dictionary is NULL.
+                ExactMembershipService(const BloomFilter* bloom,
+                                       RandomLineAccessInterface* dictionary,
+                                       const HashedDictionary* hashed = NULL,
+                                       int cache_capacity = DEFAULT_CACHE_CAPACITY);
+
+                // True if and only if some line of the dictionary is value.
+                bool query(const std::string& value);
+
+                // Sets results[i] to query(values[i]). The candidate lines
+                // of the whole batch are read with one getlines() call.
+                void query(const std::string* values, int n, bool* results);
+
+                const MembershipStatistics& getStatistics() const;
+                void resetStatistics();
+                size_t getTableSize() const;    // fingerprints held
+        private:
+                // Fingerprint in the high 32 bits, line number in the low 32,
+                // so sorting groups lines sharing a fingerprint together.
+                typedef unsigned long long TableEntry;
+
+                static unsigned int fingerprint(const std::string& value);
+                void buildFromHashes(const HashedDictionary& hashed);
+                void buildFromDictionary();
+                // Runs the tiers in front of the dictionary. Returns false
+                // if one of them rejected value; otherwise [*first, *last)
+                // are the table entries whose lines must be compared.
+                bool needsVerification(const std::string& value,
+                                       std::vector<TableEntry>::const_iterator* first,
+                                       std::vector<TableEntry>::const_iterator* last);
+                bool isKnownFalsePositive(const std::string& value) const;
+                void rememberFalsePositive(const std::string& value);
+
+                const BloomFilter* bloom_;
+                RandomLineAccessInterface* dictionary_;
+                std::vector<TableEntry> table_;     // sorted
+                int cache_capacity_;
+                std::unordered_set<std::string> false_positives_;
+                std::deque<std::string> false_positive_order_;  // oldest first
+                MembershipStatistics statistics_;
+                DISALLOW_COPY_AND_ASSIGN(ExactMembershipService);
+};
+
+// Prints how many queries each tier settled, in the same style as the test*()
+// functions.
+void printMembershipStatistics(const MembershipStatistics& statistics);
+
+#endif
@@ -0,0 +1,381 @@
+/*******************************************************************************
+ * Compressed Bloom Filter serialization
+ *
+ * Documentation available in filtercodec.h.
+*******************************************************************************/
+
+#include <bitset>       /* bitset<64>::count */
+#include <cmath>        /* ldexp, pow */
+#include <ios>          /* ios_base::failure */
+#include <vector>       /* vector */
+#include "filtercodec.h"
+
+static const char CODEC_MAGIC[4] = { 'B', 'L', 'M', 'C' };
+static const unsigned char CODEC_VERSION = 2;     // 1 had no checkpoint
+static const unsigned char ENCODING_RAW = 0;
+static const unsigned char ENCODING_RICE = 1;
+
+// Index of the lowest set bit of a non-zero word.
+static int lowestSetBit(bitword word)
+{
+#if defined(__GNUC__)
+        return __builtin_ctzll(word);
+#else
+        int bit = 0;
+        while((word & 1) == 0)
+        {
+                word >>= 1;
+                ++bit;
+        }
+        return bit;
+#endif
+}
+
+static int countSetBits(bitword word)
+{
+#if defined(__GNUC__)
+        return __builtin_popcountll(word);
+#else
+        return (int) std::bitset<BITS_PER_WORD>(word).count();
+#endif
+}
+
+static void writeInteger(std::ostream* out, unsigned long long value, int bytes)
+{
+        char buffer[8];
+        for(int i = 0; i < bytes; ++i)
+                buffer[i] = (char) (value >> (8 * i));
+        out->write(buffer, bytes);
+}
+
+static unsigned long long readInteger(std::istream* in, int bytes)
+{
+        unsigned char buffer[8];
+        in->read(reinterpret_cast<char*>(buffer), bytes);
+        if(!*in)
+                throw std::ios_base::failure("Truncated Bloom Filter stream.");
+
+        unsigned long long value = 0;
+        for(int i = 0; i < bytes; ++i)
+                value |= (unsigned long long) buffer[i] << (8 * i);
+        return value;
+}
+
+static bool isLittleEndianHost()
+{
+        const bitword one = 1;
+        return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+// Writes words as little endian bytes. Little endian hosts write the words
+// as they are; others convert a block at a time.
+static void writeWords(std::ostream* out, const bitword* words, size_t count)
+{
+        if(isLittleEndianHost())
+        {
+                out->write(reinterpret_cast<const char*>(words),
+                           count * sizeof(bitword));
+                return;
+        }
+
+        const size_t block_words = 4096;
+        std::vector<char> buffer(block_words * 8);
+        for(size_t done = 0; done < count; done += block_words)
+        {
+                size_t n = count - done < block_words ? count - done : block_words;
+                for(size_t i = 0; i < n; ++i)
+                        for(int b = 0; b < 8; ++b)
+                                buffer[i * 8 + b] = (char) (words[done + i] >> (8 * b));
+                out->write(&buffer[0], n * 8);
+        }
+}
+
+static void readWords(std::istream* in, bitword* words, size_t count)
+{
+        if(isLittleEndianHost())
+        {
+                in->read(reinterpret_cast<char*>(words),
+                         count * sizeof(bitword));
+                if(!*in)
+                        throw std::ios_base::failure("Truncated Bloom Filter stream.");
+                return;
+        }
+
+        const size_t block_words = 4096;
+        std::vector<unsigned char> buffer(block_words * 8);
+        for(size_t done = 0; done < count; done += block_words)
+        {
+                size_t n = count - done < block_words ? count - done : block_words;
+                in->read(reinterpret_cast<char*>(&buffer[0]), n * 8);
+                if(!*in)
+                        throw std::ios_base::failure("Truncated Bloom Filter stream.");
+                for(size_t i = 0; i < n; ++i)
+                {
+                        bitword word = 0;
+                        for(int b = 0; b < 8; ++b)
+                                word |= (bitword) buffer[i * 8 + b] << (8 * b);
+                        words[done + i] = word;
+                }
+        }
+}
+
+// Appends bits least significant first into a growing word array.
+class BitWriter
+{
+        public:
+                BitWriter() : current_(0), used_(0) {}
+
+                // Writes the low `count` bits of value (count <= 57).
+                void put(bitword value, int count)
+                {
+                        current_ |= value << used_;
+                        used_ += count;
+                        if(used_ >= BITS_PER_WORD)
+                        {
+                                words_.push_back(current_);
+                                used_ -= BITS_PER_WORD;
+                                current_ = used_ ? value >> (count - used_) : 0;
+                        }
+                }
+
+                // Writes `zeros` zero bits followed by a one bit.
+                void putUnary(hash zeros)
+                {
+                        while(zeros >= 32)
+                        {
+                                put(0, 32);
+                                zeros -= 32;
+                        }
+                        put(bitword(1) << zeros, (int) zeros + 1);
+                }
+
+                // Flushes the partial word plus one zero word of padding so
+                // the reader may always look 64 bits ahead.
+                std::vector<bitword>& finish()
+                {
+                        if(used_ > 0)
+                                words_.push_back(current_);
+                        words_.push_back(0);
+                        current_ = 0;
+                        used_ = 0;
+                        return words_;
+                }
+        private:
+                std::vector<bitword> words_;
+                bitword current_;
+                int used_;
+};
+
+// The Rice parameter minimizing the expected code length for geometric gaps
+// with the given fill. A gap costs parameter + 1 bits plus its quotient,
+// and the quotient is at least j with probability (1 - fill)^(j 2^parameter).
+// log2(mean * ln 2) is close to the answer but rounding it either way
+// costs several percent near the densities the planner picks.
+static int riceParameter(hash bitarray_length, hash set_bits)
+{
+        if(set_bits == 0 || set_bits >= bitarray_length)
+                return 0;
+
+        double fill = (double) set_bits / bitarray_length;
+        int best = 0;
+        double best_bits = 0;
+        for(int parameter = 0; parameter <= 56; ++parameter)
+        {
+                double r = std::pow(1 - fill, std::ldexp(1.0, parameter));
+                double bits = parameter + 1 + r / (1 - r);
+                if(parameter == 0 || bits < best_bits)
+                {
+                        best = parameter;
+                        best_bits = bits;
+                }
+        }
+        return best;
+}
+
+// Encodes the distance from one set bit to the next, minus one, as a unary
+// quotient followed by `parameter` low bits. If that is no smaller than the
+// raw bit array, the raw words are written instead.
+unsigned long long FilterCodec::write(const BloomFilter& bloom, std::ostream* out)
+{
+        const BitArray& bits = bloom.bitarray;
+
+        hash set_bits = 0;
+        for(size_t w = 0; w < bits.size(); ++w)
+                set_bits += countSetBits(bits[w]);
+
+        int parameter = riceParameter(bloom.bitarray_length_, set_bits);
+        bitword low_mask = (bitword(1) << parameter) - 1;
+
+        BitWriter writer;
+        hash next_expected = 0;     // position just after the previous set bit
+        for(size_t w = 0; w < bits.size(); ++w)
+        {
+                bitword word = bits[w];
+                while(word)
+                {
+                        hash position = (hash) w * BITS_PER_WORD +
+                                        lowestSetBit(word);
+                        hash gap = position - next_expected;
+                        writer.putUnary(gap >> parameter);
+                        if(parameter > 0)
+                                writer.put(gap & low_mask, parameter);
+                        next_expected = position + 1;
+                        word &= word - 1;
+                }
+        }
+        std::vector<bitword>& coded = writer.finish();
+
+        unsigned char encoding = ENCODING_RICE;
+        const bitword* payload = coded.empty() ? NULL : &coded[0];
+        size_t payload_words = coded.size();
+        if(coded.size() >= bits.size())
+        {
+                encoding = ENCODING_RAW;
+                payload = &bits[0];
+                payload_words = bits.size();
+        }
+
+        out->write(CODEC_MAGIC, sizeof(CODEC_MAGIC));
+        writeInteger(out, CODEC_VERSION, 1);
+        writeInteger(out, bloom.layout_, 1);
+        writeInteger(out, bloom.active_hashes_count_, 1);
+        writeInteger(out, encoding, 1);
+        writeInteger(out, bloom.bitarray_length_, 8);
+        writeInteger(out, set_bits, 8);
+        writeInteger(out, parameter, 1);
+        writeInteger(out, payload_words, 8);
+        writeInteger(out, bloom.checkpoint_.byte_offset, 8);
+        writeInteger(out, (unsigned long long) bloom.checkpoint_.line_count, 8);
+        writeInteger(out, bloom.checkpoint_.fingerprint, 8);
+        writeWords(out, payload, payload_words);
+
+        if(!*out)
+                throw std::ios_base::failure("Could not write Bloom Filter stream.");
+
+        return 57 + 8ULL * payload_words;
+}
+
+// Decodes gaps straight into the new filter's zeroed bit array. Each step
+// reads a 64 bit window at the current bit offset: the unary quotient is the
+// count of trailing zeros, the remainder the bits just after the terminating
+// one. Long runs of zeros are skipped a whole window at a time.
+BloomFilter* FilterCodec::read(std::istream* in, const AllocationPolicy& policy)
+{
+        char magic[sizeof(CODEC_MAGIC)];
+        in->read(magic, sizeof(magic));
+        if(!*in || std::string(magic, sizeof(magic)) !=
+                   std::string(CODEC_MAGIC, sizeof(CODEC_MAGIC)))
+                throw std::ios_base::failure("Not a Bloom Filter stream.");
+        unsigned long long version = readInteger(in, 1);
+        if(version < 1 || version > CODEC_VERSION)
+                throw std::ios_base::failure("Unsupported Bloom Filter stream version.");
+
+        FilterLayout layout = (FilterLayout) readInteger(in, 1);
+        int hashcount = (int) readInteger(in, 1);
+        unsigned long long encoding = readInteger(in, 1);
+        hash bitarray_length = (hash) readInteger(in, 8);
+        hash set_bits = (hash) readInteger(in, 8);
+        int parameter = (int) readInteger(in, 1);
+        unsigned long long payload_words = readInteger(in, 8);
+
+        TrainingCheckpoint checkpoint;
+        checkpoint.byte_offset = 0;
+        checkpoint.line_count = 0;
+        checkpoint.fingerprint = 0;
+        if(version >= 2)
+        {
+                checkpoint.byte_offset = readInteger(in, 8);
+                checkpoint.line_count = (long long) readInteger(in, 8);
+                checkpoint.fingerprint = readInteger(in, 8);
+        }
+
+        if(layout >= FILTER_LAYOUT_COUNT || encoding > ENCODING_RICE ||
+           parameter > 56 || bitarray_length == 0 || hashcount < 1 ||
+           hashcount > BloomFilter::MAX_HASH_COUNT)
+                throw std::ios_base::failure("Corrupt Bloom Filter header.");
+
+        BloomFilter* bloom = new BloomFilter(bitarray_length, hashcount, layout,
+                                             policy);
+        bloom->checkpoint_ = checkpoint;
+        BitArray& bits = bloom->bitarray;
+
+        try
+        {
+                if(encoding == ENCODING_RAW)
+                {
+                        if(payload_words != bits.size())
+                                throw std::ios_base::failure("Corrupt Bloom Filter header.");
+                        readWords(in, &bits[0], bits.size());
+                        return bloom;
+                }
+
+                std::vector<bitword> coded(payload_words);
+                if(payload_words > 0)
+                        readWords(in, &coded[0], coded.size());
+
+                const hash total_bits = (hash) payload_words * BITS_PER_WORD;
+                const bitword low_mask = (bitword(1) << parameter) - 1;
+                hash offset = 0;            // read position in coded
+                hash next_expected = 0;     // position just after last set bit
+
+                for(hash i = 0; i < set_bits; ++i)
+                {
+                        hash quotient = 0;
+                        bitword window;
+                        for(;;)
+                        {
+                                if(offset + BITS_PER_WORD > total_bits)
+                                        throw std::ios_base::failure("Corrupt Bloom Filter payload.");
+                                size_t w = offset / BITS_PER_WORD;
+                                int shift = offset % BITS_PER_WORD;
+                                window = coded[w] >> shift;
+                                if(shift)
+                                        window |= coded[w + 1] << (BITS_PER_WORD - shift);
+                                if(window)
+                                        break;
+                                quotient += BITS_PER_WORD;
+                                offset += BITS_PER_WORD;
+                        }
+
+                        int zeros = lowestSetBit(window);
+                        quotient += zeros;
+                        offset += zeros + 1;
+
+                        // The remainder usually sits in the same window.
+
+                        hash remainder = 0;
+                        if(zeros + 1 + parameter <= BITS_PER_WORD)
+                        {
+                                remainder = (window >> zeros >> 1) & low_mask;
+                                offset += parameter;
+                        }
+                        else
+                        {
+                                if(offset + BITS_PER_WORD > total_bits)
+                                        throw std::ios_base::failure("Corrupt Bloom Filter payload.");
+                                size_t w = offset / BITS_PER_WORD;
+                                int shift = offset % BITS_PER_WORD;
+                                bitword low = coded[w] >> shift;
+                                if(shift)
+                                        low |= coded[w + 1] << (BITS_PER_WORD - shift);
+                                remainder = low & low_mask;
+                                offset += parameter;
+                        }
+
+                        hash position = next_expected +
+                                        (quotient << parameter) + remainder;
+                        if(position >= bitarray_length)
+                                throw std::ios_base::failure("Corrupt Bloom Filter payload.");
+                        bits[position / BITS_PER_WORD] |=
+                                        bitword(1) << (position % BITS_PER_WORD);
+                        next_expected = position + 1;
+                }
+        }
+        catch(...)
+        {
+                delete bloom;
+                throw;
+        }
+
+        return bloom;
+}
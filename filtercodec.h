@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Compressed Bloom Filter serialization
+ *
+ * A Bloom Filter planned for transmission (FilterPlanner::
+ * planForTransmission) uses few hashes over a long bit array, which is
+ * mostly zeros, so shipping its raw bit array wastes bandwidth. FilterCodec stores the gaps
+ * between set bits with Golomb-Rice coding, which approaches the entropy of
+ * the bit array, and falls back to the raw words for dense filters where
+ * coding would not pay off. Decoding only touches the set bits, so a node
+ * can rebuild the bit array much faster than it could download it raw.
+*******************************************************************************/
+
+#include <istream>      /* istream */
+#include <ostream>      /* ostream */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef FILTER_CODEC_H_
+#define FILTER_CODEC_H_
+
+// Reads and writes Bloom Filters in the following format. Integers are
+// little endian regardless of the host.
+//      4 bytes   magic "BLMC"
+//      1 byte    format version
+//      1 byte    layout (FilterLayout)
+//      1 byte    hashcount (k)
+//      1 byte    encoding: 0 = raw words, 1 = Golomb-Rice coded gaps
+//      8 bytes   bitarray length (m)
+//      8 bytes   number of set bits
+//      1 byte    Rice parameter (low bits per gap)
+//      8 bytes   payload length in 64 bit words
+//      8 bytes   training checkpoint: byte offset      (version 2 onward)
+//      8 bytes   training checkpoint: line count       (version 2 onward)
+//      8 bytes   training checkpoint: fingerprint      (version 2 onward)
+//      payload
+// Cannot be instantiated.
+//      Example usage:
+//          FilterCodec::write(bloom, &out_file);
+//          BloomFilter* replica = FilterCodec::read(&in_file);
+class FilterCodec
+{
+        public:
+                // Writes bloom to out. Returns the number of bytes written.
+                static unsigned long long write(const BloomFilter& bloom,
+                                                std::ostream* out);
+
+                // Reads a filter written by write() into a bit array
+                // allocated according to policy. Throws
+                // std::ios_base::failure on a truncated or foreign stream.
+                // It is the user's responsibility to delete the result.
+                static BloomFilter* read(std::istream* in,
+                                         const AllocationPolicy& policy = AllocationPolicy());
+        protected:
+                FilterCodec();  // Disallows instantiation
+        private:
+                DISALLOW_COPY_AND_ASSIGN(FilterCodec);
+};
+
+#endif
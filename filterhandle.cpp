@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Lock-free hot swapping of a serving filter
+ *
+ * Documentation available in filterhandle.h. FilterHandle itself is a
+ * template and lives entirely in the header; this file holds the fences.
+*******************************************************************************/
+
+#include <atomic>       /* atomic_thread_fence */
+#include "filterhandle.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>    /* SYS_membarrier */
+#include <unistd.h>         /* syscall */
+
+// From <linux/membarrier.h>, which is not always installed.
+#define BLOOM_MEMBARRIER_CMD_QUERY 0
+#define BLOOM_MEMBARRIER_CMD_PRIVATE_EXPEDITED (1 << 3)
+#define BLOOM_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED (1 << 4)
+#endif
+
+// Expedited private membarrier (Linux 4.14+) interrupts only the threads of
+// this process, which makes it cheap enough to issue on every reclaim.
+bool enableAsymmetricFences()
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+        long supported = syscall(SYS_membarrier, BLOOM_MEMBARRIER_CMD_QUERY, 0);
+        if(supported < 0 ||
+           (supported & BLOOM_MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0)
+                return false;
+        return syscall(SYS_membarrier,
+                       BLOOM_MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+        return false;
+#endif
+}
+
+void heavyFence()
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+        if(syscall(SYS_membarrier,
+                   BLOOM_MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0)
+                return;
+#endif
+        // Only reached if registration succeeded and the call still failed;
+        // a local fence is the best that can be done.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+}
@@ -0,0 +1,324 @@
+/*******************************************************************************
+ * Lock-free hot swapping of a serving filter
+ *
+ * Filters are rebuilt periodically while queries keep flowing, but a
+ * BloomFilter cannot be copied or retrained in place. FilterHandle holds the
+ * filter currently being served. Readers reach it without locks or atomic
+ * read-modify-write instructions; a writer can publish a replacement at any
+ * time, and the old filter is deleted once every reader has moved past it
+ * (epoch based reclamation).
+*******************************************************************************/
+
+#include <atomic>       /* atomic, atomic_thread_fence */
+#include <cstddef>      /* size_t */
+#include <memory>       /* align */
+#include <new>          /* placement new */
+#include <mutex>        /* mutex, lock_guard */
+#include <stdexcept>    /* runtime_error */
+#include <string>       /* string */
+#include <thread>       /* this_thread::yield */
+#include <vector>       /* vector */
+#include "macros.h"
+
+#ifndef FILTER_HANDLE_H_
+#define FILTER_HANDLE_H_
+
+const size_t CACHE_LINE_BYTES = 64;
+
+// Registers the process for asymmetric fences (Linux membarrier). Returns
+// false if unavailable, in which case readers fall back to a full fence.
+bool enableAsymmetricFences();
+
+// The writer's half of an asymmetric fence: forces a full barrier on every
+// running thread of the process, so readers only need a compiler barrier.
+void heavyFence();
+
+// Publishes one Filter (anything with a const query(const std::string&)
+// method: BloomFilter, a filter read by FilterCodec, ...) to any number of
+// readers.
+// Each reader thread registers a Reader once; queries then only store the
+// current epoch into the reader's own cache line and load the filter
+// pointer. The handle owns every filter given to it.
+//      Example usage:
+//          FilterHandle<BloomFilter> handle(trained_filter);
+//          // in each reader thread:
+//          FilterHandle<BloomFilter>::Reader reader(&handle);
+//          reader.query("hello");
+//          // in the rebuilding thread:
+//          handle.publish(retrained_filter);
+template <class Filter>
+class FilterHandle
+{
+        public:
+                class Reader;
+
+                // Scoped read-side critical section. The filter it points to
+                // stays alive until the guard is destroyed, even if a new
+                // one is published meanwhile. Guards on one Reader may nest;
+                // inner guards see the outermost guard's filter, and the
+                // section ends when the outermost guard is destroyed.
+                class ReadGuard
+                {
+                        public:
+                                explicit ReadGuard(Reader* reader)
+                                        : reader_(reader),
+                                          filter_(reader->enter()) {}
+                                ~ReadGuard() { reader_->exit(); }
+                                const Filter* operator->() const { return filter_; }
+                                const Filter& operator*() const { return *filter_; }
+                        private:
+                                Reader* reader_;
+                                const Filter* filter_;
+                                DISALLOW_COPY_AND_ASSIGN(ReadGuard);
+                };
+
+                // A reader thread's registration. Must only be used by the
+                // thread which created it.
+                class Reader
+                {
+                        public:
+                                explicit Reader(FilterHandle* handle)
+                                        : handle_(handle),
+                                          slot_(handle->acquireSlot()),
+                                          depth_(0),
+                                          filter_(NULL) {}
+                                ~Reader() { handle_->releaseSlot(slot_); }
+
+                                bool query(const std::string& value)
+                                {
+                                        ReadGuard guard(this);
+                                        return guard->query(value);
+                                }
+                        private:
+                                friend class ReadGuard;
+
+                                // Only the outermost guard announces an
+                                // epoch: an inner one clearing the slot on
+                                // exit would expose the outer one's filter.
+                                const Filter* enter()
+                                {
+                                        if(depth_++ == 0)
+                                                filter_ = handle_->enter(slot_);
+                                        return filter_;
+                                }
+                                void exit()
+                                {
+                                        if(--depth_ == 0)
+                                                handle_->exit(slot_);
+                                }
+
+                                FilterHandle* handle_;
+                                int slot_;
+                                int depth_;     // ReadGuards alive
+                                const Filter* filter_;  // while depth_ > 0
+                                DISALLOW_COPY_AND_ASSIGN(Reader);
+                };
+
+                // Takes ownership of initial. max_readers bounds the number
+                // of simultaneously registered Reader objects.
+                explicit FilterHandle(Filter* initial, int max_readers = 256);
+                ~FilterHandle();    // requires that no Reader remains
+
+                // Makes next the filter new queries see and retires the old
+                // one. Takes ownership of next. Never waits for readers;
+                // retired filters are deleted by this or a later publish(),
+                // reclaim() or synchronize().
+                void publish(Filter* next);
+
+                // Deletes retired filters no reader can still see. Returns
+                // the number deleted.
+                int reclaim();
+
+                // Waits until every retired filter has been deleted.
+                void synchronize();
+
+                int getRetiredCount();
+        private:
+                // One reader's announced epoch, alone on its cache line so
+                // readers never contend. 0 means outside any read section.
+                // Before C++17 neither new nor std::allocator honours the
+                // alignment, so slots live in storage aligned by hand.
+                struct alignas(CACHE_LINE_BYTES) Slot
+                {
+                        std::atomic<unsigned long long> epoch;
+                        bool in_use;
+                };
+
+                struct Retired
+                {
+                        Filter* filter;
+                        unsigned long long epoch;   // last epoch it was current
+                };
+
+                int acquireSlot();
+                void releaseSlot(int slot);
+                const Filter* enter(int slot);
+                void exit(int slot);
+                bool isVisible(unsigned long long retired_epoch);
+
+                std::atomic<Filter*> current_;
+                std::atomic<unsigned long long> epoch_;
+                std::vector<char> slot_storage_;
+                Slot* slots_;       // slot_count_ of them, inside slot_storage_
+                size_t slot_count_;
+                std::vector<Retired> retired_;
+                std::mutex writer_mutex_;   // publish, reclaim, registration
+                bool asymmetric_fences_;
+                DISALLOW_COPY_AND_ASSIGN(FilterHandle);
+};
+
+template <class Filter>
+FilterHandle<Filter>::FilterHandle(Filter* initial, int max_readers)
+        : current_(initial), epoch_(1),
+          slot_storage_((max_readers > 0 ? max_readers : 0) * sizeof(Slot) +
+                        CACHE_LINE_BYTES),
+          slots_(NULL), slot_count_(max_readers > 0 ? max_readers : 0),
+          retired_(), asymmetric_fences_(enableAsymmetricFences())
+{
+        void* aligned = &slot_storage_[0];
+        size_t space = slot_storage_.size();
+        std::align(CACHE_LINE_BYTES, slot_count_ * sizeof(Slot), aligned, space);
+        slots_ = static_cast<Slot*>(aligned);
+        for(size_t i = 0; i < slot_count_; ++i)
+        {
+                new (&slots_[i]) Slot;
+                slots_[i].epoch.store(0, std::memory_order_relaxed);
+                slots_[i].in_use = false;
+        }
+}
+
+template <class Filter>
+FilterHandle<Filter>::~FilterHandle()
+{
+        for(size_t i = 0; i < slot_count_; ++i)
+                slots_[i].~Slot();
+        for(size_t i = 0; i < retired_.size(); ++i)
+                delete retired_[i].filter;
+        delete current_.load();
+}
+
+template <class Filter>
+int FilterHandle<Filter>::acquireSlot()
+{
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        for(size_t i = 0; i < slot_count_; ++i)
+        {
+                if(!slots_[i].in_use)
+                {
+                        slots_[i].in_use = true;
+                        return (int) i;
+                }
+        }
+        throw std::runtime_error("FilterHandle: too many registered readers.");
+}
+
+template <class Filter>
+void FilterHandle<Filter>::releaseSlot(int slot)
+{
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        slots_[slot].epoch.store(0, std::memory_order_release);
+        slots_[slot].in_use = false;
+}
+
+// Announces the epoch before loading the filter pointer. The store must be
+// visible to a reclaiming writer before the load happens; with asymmetric
+// fences the writer's heavyFence() provides that ordering, so the reader
+// only has to stop the compiler from reordering the two.
+template <class Filter>
+const Filter* FilterHandle<Filter>::enter(int slot)
+{
+        slots_[slot].epoch.store(epoch_.load(std::memory_order_acquire),
+                                 std::memory_order_relaxed);
+        if(asymmetric_fences_)
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+        else
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+        return current_.load(std::memory_order_acquire);
+}
+
+template <class Filter>
+void FilterHandle<Filter>::exit(int slot)
+{
+        slots_[slot].epoch.store(0, std::memory_order_release);
+}
+
+// A reader which announced epoch e loaded the pointer after the epoch was
+// read, so it can only hold a filter that was current at epoch e or later.
+// The filter retired at retired_epoch is visible to readers with
+// 0 < e <= retired_epoch.
+template <class Filter>
+bool FilterHandle<Filter>::isVisible(unsigned long long retired_epoch)
+{
+        for(size_t i = 0; i < slot_count_; ++i)
+        {
+                unsigned long long e = slots_[i].epoch.load(std::memory_order_acquire);
+                if(e != 0 && e <= retired_epoch)
+                        return true;
+        }
+        return false;
+}
+
+template <class Filter>
+void FilterHandle<Filter>::publish(Filter* next)
+{
+        {
+                std::lock_guard<std::mutex> lock(writer_mutex_);
+                Retired retired;
+                retired.filter = current_.exchange(next);
+                retired.epoch = epoch_.fetch_add(1);
+                retired_.push_back(retired);
+        }
+        reclaim();
+}
+
+template <class Filter>
+int FilterHandle<Filter>::reclaim()
+{
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        if(retired_.empty())
+                return 0;
+
+        // Pairs with the reader's fence in enter(): the exchange in publish()
+        // must be visible before the slots are read, or a reader could load
+        // the old pointer after announcing an epoch this scan misses.
+        if(asymmetric_fences_)
+                heavyFence();
+        else
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        int deleted = 0;
+        size_t kept = 0;
+        for(size_t i = 0; i < retired_.size(); ++i)
+        {
+                if(isVisible(retired_[i].epoch))
+                {
+                        retired_[kept++] = retired_[i];
+                }
+                else
+                {
+                        delete retired_[i].filter;
+                        ++deleted;
+                }
+        }
+        retired_.resize(kept);
+        return deleted;
+}
+
+template <class Filter>
+void FilterHandle<Filter>::synchronize()
+{
+        while(getRetiredCount() > 0)
+        {
+                reclaim();
+                std::this_thread::yield();
+        }
+}
+
+template <class Filter>
+int FilterHandle<Filter>::getRetiredCount()
+{
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        return (int) retired_.size();
+}
+
+#endif
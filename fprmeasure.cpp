@@ -0,0 +1,207 @@
+/*******************************************************************************
+ * Large scale false positive rate measurement
+ *
+ * Documentation available in fprmeasure.h.
+*******************************************************************************/
+
+#include <algorithm>    /* max */
+#include <cmath>        /* exp, log, lgamma, pow, sqrt */
+#include <thread>       /* thread, hardware_concurrency */
+#include <vector>       /* vector */
+#include "fprmeasure.h"
+
+// Per thread tallies, summed once every thread has joined.
+struct ProbeTally
+{
+        long long probes;
+        long long true_members;
+        long long false_positives;
+};
+
+// xorshift64* (Vigna). rand() shares hidden state between threads, so each
+// probing thread owns one of these instead.
+static unsigned long long nextRandom(unsigned long long* state)
+{
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        return *state * 2685821657736338717ULL;
+}
+
+// Generates probe_count words of 8 to 12 characters drawn from the same
+// ['A', '~') range as randomChar(). Shorter words would repeat: there are
+// only about 3,800 words of one or two characters, and repeated probes are
+// not the independent samples the confidence interval assumes. With at least
+// 61^8 (about 2 * 10^14) possible words, repeats are negligible. The probe
+// string is reused, so probing does not allocate once it has grown to the
+// longest word.
+static void probeRange(const BloomFilter* bloom, const ExactDictionary* exact,
+                       long long probe_count, unsigned long long state,
+                       ProbeTally* tally)
+{
+        const int min_length = 8;
+        const int max_length = 12;
+        std::string probe;
+        probe.reserve(max_length);
+
+        tally->probes = probe_count;
+        tally->true_members = 0;
+        tally->false_positives = 0;
+
+        for(long long i = 0; i < probe_count; ++i)
+        {
+                unsigned long long bits = nextRandom(&state);
+                int length = min_length +
+                             (int) (bits % (max_length - min_length + 1));
+
+                probe.clear();
+                for(int j = 0; j < length; ++j)
+                        probe += (char) ('A' + nextRandom(&state) % ('~' - 'A'));
+
+                // Only positives need the (comparatively slow) exact lookup.
+
+                if(bloom->query(probe))
+                {
+                        if(exact->count(probe))
+                                tally->true_members++;
+                        else
+                                tally->false_positives++;
+                }
+                else if(exact->count(probe))
+                {
+                        // A Bloom Filter never rejects a member it was trained
+                        // on; counted so the caller can still spot the bug.
+                        tally->true_members++;
+                }
+        }
+}
+
+// Reads DICTIONARY_FILE through visitDictionary(), so that the exact
+// dictionary and the Bloom Filter agree on what a key is.
+long long loadExactDictionary(const char* DICTIONARY_FILE,
+                              ExactDictionary* exact)
+{
+        visitDictionary(DICTIONARY_FILE,
+                        [exact](const std::string& line) { exact->insert(line); });
+        return (long long) exact->size();
+}
+
+// See pages.cs.wisc.edu/~cao/papers/summary-cache/node8.html. The blocked
+// rate follows Putze, Sanders and Singler, "Cache-, Hash- and Space-Efficient
+// Bloom Filters": a block holding j keys answers a foreign query positively
+// with probability (1 - (1 - 1/B)^(jk))^k. The Poisson terms are evaluated in
+// log space so heavily loaded blocks (large lambda) do not underflow, and
+// only the terms within a dozen standard deviations of lambda are summed.
+double theoreticalFalsePositiveRate(hash bitarray_length,
+                                    int hashcount,
+                                    long long key_count,
+                                    FilterLayout layout)
+{
+        if(bitarray_length == 0)
+                return 1.0;
+
+        if(layout == LAYOUT_STANDARD || bitarray_length < BLOOM_BLOCK_BITS)
+        {
+                double fill = 1.0 - std::exp(-(double) hashcount * key_count /
+                                             (double) bitarray_length);
+                return std::pow(fill, hashcount);
+        }
+
+        double blocks = (double) (bitarray_length / BLOOM_BLOCK_BITS);
+        double lambda = key_count / blocks;
+        if(lambda <= 0)
+                return 0.0;
+        double spread = 12 * std::sqrt(lambda) + 10;
+        long long first = (long long) std::max(0.0, std::floor(lambda - spread));
+        long long last = (long long) std::ceil(lambda + spread);
+        double miss = std::log(1.0 - 1.0 / BLOOM_BLOCK_BITS);
+
+        double rate = 0;
+        for(long long j = first; j <= last; ++j)
+        {
+                double log_poisson = -lambda + j * std::log(lambda) -
+                                     std::lgamma(j + 1.0);
+                double fill = 1.0 - std::exp(miss * j * hashcount);
+                rate += std::exp(log_poisson) * std::pow(fill, hashcount);
+        }
+        return rate;
+}
+
+// Splits the probes evenly over the threads; the first thread picks up the
+// remainder. Each thread derives its own generator state from seed so runs
+// are repeatable for a fixed seed and thread count. The interval is the
+// Wilson score interval, which stays sensible for rates close to zero where
+// the normal approximation would dip below 0.
+FalsePositiveMeasurement measureFalsePositiveRate(const BloomFilter* bloom,
+                                                  const ExactDictionary& exact,
+                                                  long long probe_count,
+                                                  int thread_count,
+                                                  unsigned long seed,
+                                                  double z)
+{
+        if(thread_count <= 0)
+                thread_count = (int) std::thread::hardware_concurrency();
+        if(thread_count <= 0)
+                thread_count = 1;
+
+        std::vector<ProbeTally> tallies(thread_count);
+        std::vector<std::thread> workers;
+
+        long long share = probe_count / thread_count;
+        for(int t = 0; t < thread_count; ++t)
+        {
+                long long count = share;
+                if(t == 0)
+                        count += probe_count % thread_count;
+
+                // xorshift must never be seeded with zero
+
+                unsigned long long state = (seed + 1) *
+                                           0x9E3779B97F4A7C15ULL * (t + 1);
+                if(state == 0)
+                        state = 1;
+
+                workers.push_back(std::thread(probeRange, bloom, &exact, count,
+                                              state, &tallies[t]));
+        }
+        for(int t = 0; t < thread_count; ++t)
+                workers[t].join();
+
+        FalsePositiveMeasurement result;
+        result.probes = 0;
+        result.true_members = 0;
+        result.false_positives = 0;
+        for(int t = 0; t < thread_count; ++t)
+        {
+                result.probes += tallies[t].probes;
+                result.true_members += tallies[t].true_members;
+                result.false_positives += tallies[t].false_positives;
+        }
+
+        double negatives = (double) (result.probes - result.true_members);
+        if(negatives > 0)
+        {
+                double p = result.false_positives / negatives;
+                double z2n = z * z / negatives;
+                double center = (p + z2n / 2) / (1 + z2n);
+                double spread = z * std::sqrt(p * (1 - p) / negatives +
+                                              z2n / (4 * negatives)) /
+                                (1 + z2n);
+                result.rate = p;
+                result.interval_low = center - spread < 0 ? 0 : center - spread;
+                result.interval_high = center + spread > 1 ? 1 : center + spread;
+        }
+        else
+        {
+                result.rate = 0;
+                result.interval_low = 0;
+                result.interval_high = 1;
+        }
+
+        result.theoretical = theoreticalFalsePositiveRate(
+                                        bloom->getBitarrayLength(),
+                                        bloom->getActiveHashesCount(),
+                                        (long long) exact.size(),
+                                        bloom->getLayout());
+        return result;
+}
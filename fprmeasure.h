@@ -0,0 +1,63 @@
+/*******************************************************************************
+ * Large scale false positive rate measurement
+ *
+ * test() in bloom.cpp only probes a Bloom Filter sample_size times, which is
+ * fine for a demonstration but far too coarse to tell a 0.1% filter from a
+ * 0.3% one. The functions below stream many millions of random negative
+ * probes through a Bloom Filter on every available core. Each positive is
+ * checked against an exact in-memory copy of the training dictionary so
+ * genuine members are not miscounted as false positives.
+*******************************************************************************/
+
+#include <string>           /* string */
+#include <unordered_set>    /* unordered_set */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef FPR_MEASURE_H_
+#define FPR_MEASURE_H_
+
+typedef std::unordered_set<std::string> ExactDictionary;
+
+// Result of measureFalsePositiveRate(). Probes which happen to be genuine
+// dictionary entries are counted in true_members and excluded from the rate.
+struct FalsePositiveMeasurement
+{
+        long long probes;           // total probes generated
+        long long true_members;     // probes found in the exact dictionary
+        long long false_positives;  // bloom positives not in the dictionary
+        double rate;                // false_positives / true negatives
+        double interval_low;        // Wilson score interval around rate
+        double interval_high;
+        double theoretical;         // (1 - e^(-kn/m))^k
+};
+
+// Loads every distinct line of DICTIONARY_FILE into exact. Returns the
+// number of distinct keys, which is the n used for theoretical rates.
+long long loadExactDictionary(const char* DICTIONARY_FILE,
+                              ExactDictionary* exact);
+
+// Returns the textbook false positive rate (1 - e^(-kn/m))^k for a filter of
+// bitarray_length bits and hashcount hash functions holding key_count keys.
+// For LAYOUT_BLOCKED the textbook rate is averaged over the Poisson
+// distributed number of keys landing in each block. Both assume independent
+// probes; the double hashing probes beyond HashMonster::hashFunctionCount
+// sit slightly above this (see HashMonster::probeIndices()), which only shows
+// for small filters with very low rates.
+double theoreticalFalsePositiveRate(hash bitarray_length,
+                                    int hashcount,
+                                    long long key_count,
+                                    FilterLayout layout = LAYOUT_STANDARD);
+
+// Streams probe_count random words through bloom, split over thread_count
+// threads (0 => one per hardware thread). Every probe the filter accepts is
+// looked up in exact. z selects the width of the confidence interval
+// (1.96 => 95%). The same seed always produces the same probes.
+FalsePositiveMeasurement measureFalsePositiveRate(const BloomFilter* bloom,
+                                                  const ExactDictionary& exact,
+                                                  long long probe_count,
+                                                  int thread_count,
+                                                  unsigned long seed,
+                                                  double z = 1.96);
+
+#endif
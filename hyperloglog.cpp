@@ -0,0 +1,58 @@
+/*******************************************************************************
+ * HyperLogLog distinct count estimation
+ *
+ * Documentation available in hyperloglog.h.
+*******************************************************************************/
+
+#include <cmath>        /* log, ldexp */
+#include <stdexcept>    /* invalid_argument */
+#include "hyperloglog.h"
+
+HyperLogLog::HyperLogLog(int precision)
+        : precision_(precision < 4 ? 4 : precision > 18 ? 18 : precision),
+          guard_bit_(1ULL << (precision_ - 1)),
+          registers_(size_t(1) << precision_, 0)
+{
+}
+
+// The raw estimate is the scaled harmonic mean of 2^register. While many
+// registers are still zero it is badly biased, and linear counting over the
+// empty registers is used instead.
+double HyperLogLog::estimate() const
+{
+        double m = (double) registers_.size();
+        double alpha = precision_ == 4 ? 0.673 :
+                       precision_ == 5 ? 0.697 :
+                       precision_ == 6 ? 0.709 :
+                       0.7213 / (1.0 + 1.079 / m);
+
+        double sum = 0;
+        size_t zeros = 0;
+        for(size_t i = 0; i < registers_.size(); ++i)
+        {
+                sum += std::ldexp(1.0, -registers_[i]);
+                if(registers_[i] == 0)
+                        ++zeros;
+        }
+
+        double raw = alpha * m * m / sum;
+        if(raw <= 2.5 * m && zeros > 0)
+                return m * std::log(m / (double) zeros);
+        return raw;
+}
+
+void HyperLogLog::merge(const HyperLogLog& other)
+{
+        if(other.precision_ != precision_)
+                throw std::invalid_argument("HyperLogLog estimators of different precision cannot be merged.");
+        for(size_t i = 0; i < registers_.size(); ++i)
+        {
+                if(other.registers_[i] > registers_[i])
+                        registers_[i] = other.registers_[i];
+        }
+}
+
+int HyperLogLog::getPrecision() const
+{
+        return precision_;
+}
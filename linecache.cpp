@@ -0,0 +1,215 @@
+/*******************************************************************************
+ * Hot line cache
+ *
+ * Documentation available in linecache.h.
+*******************************************************************************/
+
+#include "linecache.h"
+
+// Per line bookkeeping charged against the capacity on top of the line
+// itself: the entry, its hash node and its queue slot, roughly.
+static const size_t ENTRY_OVERHEAD_BYTES = 64;
+
+// S3-FIFO gives the probationary queue a tenth of the cache.
+CachedLineAccess::CachedLineAccess(RandomLineAccessInterface* source,
+                                   size_t capacity_bytes)
+        : source_(source),
+          capacity_bytes_(capacity_bytes),
+          small_capacity_bytes_(capacity_bytes / 10),
+          small_bytes_(0),
+          main_bytes_(0),
+          ghost_sequence_(0),
+          hits_(0),
+          misses_(0)
+{
+}
+
+std::string CachedLineAccess::getline(int line_number)
+{
+        const std::string* cached = lookup(line_number);
+        if(cached != NULL)
+                return *cached;
+
+        std::string line = source_->getline(line_number);
+        insert(line_number, line.data(), line.size());
+        return line;
+}
+
+bool CachedLineAccess::query(std::string value)
+{
+        return source_->query(value);
+}
+
+int CachedLineAccess::getLineCount() const
+{
+        return source_->getLineCount();
+}
+
+// Hits are only counted in the first pass, not copied: inserting the
+// fetched misses may evict them, so every line is copied into the batch
+// before anything is inserted. Until then a line is cached exactly when it
+// was a hit, and the misses appear in fetched_ in request order.
+void CachedLineAccess::getlines(const int* line_numbers, int n,
+                                LineBatch* lines)
+{
+        missing_.clear();
+        for(int i = 0; i < n; ++i)
+        {
+                if(lookup(line_numbers[i]) == NULL)
+                        missing_.push_back(line_numbers[i]);
+        }
+        if(!missing_.empty())
+                source_->getlines(missing_.data(), (int) missing_.size(),
+                                  &fetched_);
+
+        lines->clear();
+        int next_missing = 0;
+        for(int i = 0; i < n; ++i)
+        {
+                std::unordered_map<int, Entry>::const_iterator found =
+                                entries_.find(line_numbers[i]);
+                if(found == entries_.end())
+                {
+                        LineView view = fetched_[next_missing++];
+                        lines->append(view.data, view.length);
+                }
+                else
+                {
+                        lines->append(found->second.line.data(),
+                                      found->second.line.size());
+                }
+        }
+
+        for(int i = 0; i < (int) missing_.size(); ++i)
+        {
+                LineView view = fetched_[i];
+                insert(missing_[i], view.data, view.length);
+        }
+}
+
+// A hit only bumps the entry's frequency; entries never move on a hit,
+// which is what keeps S3-FIFO cheap.
+const std::string* CachedLineAccess::lookup(int line_number)
+{
+        std::unordered_map<int, Entry>::iterator found =
+                        entries_.find(line_number);
+        if(found == entries_.end())
+        {
+                ++misses_;
+                return NULL;
+        }
+        ++hits_;
+        if(found->second.frequency < 3)
+                ++found->second.frequency;
+        return &found->second.line;
+}
+
+size_t CachedLineAccess::cost(const Entry& entry) const
+{
+        return entry.line.size() + ENTRY_OVERHEAD_BYTES;
+}
+
+// Lines evicted from probation recently enough to still be remembered were
+// evicted too early: they go straight to the main queue.
+void CachedLineAccess::insert(int line_number, const char* data, size_t length)
+{
+        if(entries_.count(line_number) != 0 ||
+           length + ENTRY_OVERHEAD_BYTES > capacity_bytes_)
+                return;
+
+        Entry& entry = entries_[line_number];
+        entry.line.assign(data, length);
+        entry.frequency = 0;
+
+        std::unordered_map<int, unsigned long long>::iterator ghost =
+                        ghosts_.find(line_number);
+        entry.in_main = ghost != ghosts_.end();
+        if(entry.in_main)
+        {
+                ghosts_.erase(ghost);
+                main_.push_back(line_number);
+                main_bytes_ += cost(entry);
+        }
+        else
+        {
+                small_.push_back(line_number);
+                small_bytes_ += cost(entry);
+        }
+        evict();
+}
+
+void CachedLineAccess::evict()
+{
+        while(small_bytes_ + main_bytes_ > capacity_bytes_)
+        {
+                if(small_bytes_ > small_capacity_bytes_ || main_.empty())
+                        evictSmall();
+                else
+                        evictMain();
+        }
+}
+
+// Lines read again while on probation are promoted; the rest are dropped
+// and remembered as ghosts.
+void CachedLineAccess::evictSmall()
+{
+        int line_number = small_.front();
+        small_.pop_front();
+        Entry& entry = entries_[line_number];
+        size_t bytes = cost(entry);
+        small_bytes_ -= bytes;
+
+        if(entry.frequency > 0)
+        {
+                entry.frequency = 0;
+                entry.in_main = true;
+                main_.push_back(line_number);
+                main_bytes_ += bytes;
+        }
+        else
+        {
+                entries_.erase(line_number);
+                remember(line_number);
+        }
+}
+
+// CLOCK-like: a line read since it last reached the front gets another
+// pass through the queue, one per read up to the frequency cap.
+void CachedLineAccess::evictMain()
+{
+        int line_number = main_.front();
+        main_.pop_front();
+        Entry& entry = entries_[line_number];
+
+        if(entry.frequency > 0)
+        {
+                --entry.frequency;
+                main_.push_back(line_number);
+        }
+        else
+        {
+                main_bytes_ -= cost(entry);
+                entries_.erase(line_number);
+        }
+}
+
+// The ghost queue remembers as many lines as the main queue holds. Queue
+// slots whose ghost was since revived or re-remembered are stale and are
+// dropped as they reach the front.
+void CachedLineAccess::remember(int line_number)
+{
+        ghosts_[line_number] = ++ghost_sequence_;
+        ghost_queue_.push_back(std::make_pair(line_number, ghost_sequence_));
+
+        size_t limit = main_.size() > 16 ? main_.size() : 16;
+        while(!ghost_queue_.empty() &&
+              (ghosts_.size() > limit || ghost_queue_.size() > 2 * limit))
+        {
+                std::pair<int, unsigned long long> oldest = ghost_queue_.front();
+                ghost_queue_.pop_front();
+                std::unordered_map<int, unsigned long long>::iterator ghost =
+                                ghosts_.find(oldest.first);
+                if(ghost != ghosts_.end() && ghost->second == oldest.second)
+                        ghosts_.erase(ghost);
+        }
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Hot line cache
+ *
+ * Validation jobs sample dictionary lines with heavy skew, so the same lines
+ * are fetched again and again, each time with a disk seek. CachedLineAccess
+ * wraps any RandomLineAccessInterface and keeps recently used lines in
+ * memory, bounded by a byte budget. Eviction is S3-FIFO: new lines enter a
+ * small probationary queue and only lines read again while there are
+ * promoted to the main queue, so one long scan over the dictionary cannot
+ * flush the lines that are genuinely hot.
+*******************************************************************************/
+
+#include <cstddef>          /* size_t */
+#include <deque>            /* deque */
+#include <string>           /* string */
+#include <unordered_map>    /* unordered_map */
+#include <utility>          /* pair, make_pair */
+#include <vector>           /* vector */
+#include "macros.h"
+#include "randomlineaccess.h"
+
+#ifndef LINE_CACHE_H_
+#define LINE_CACHE_H_
+
+// A RandomLineAccessInterface which answers getline() from memory when it
+// can and from source otherwise. query() and getLineCount() go straight to
+// source. Like DenseLineCache::getline(), it must only be used by one thread
+// at a time.
+//      Example usage:
+//          DenseLineCache dictionary("wordlist.txt");
+//          CachedLineAccess cached(&dictionary, 64 << 20);
+//          cached.getline(27013);  // reads the file
+//          cached.getline(27013);  // served from memory
+class CachedLineAccess : public virtual RandomLineAccessInterface
+{
+        public:
+                // source is not owned and must outlive the cache.
+                // capacity_bytes bounds the lines held plus a fixed estimate
+                // of the bookkeeping per line.
+                CachedLineAccess(RandomLineAccessInterface* source,
+                                 size_t capacity_bytes);
+                virtual ~CachedLineAccess() {}
+
+                virtual std::string getline(int line_number);
+                virtual bool query(std::string value);
+                virtual int getLineCount() const;
+
+                // Serves what it can from memory and fetches the remaining
+                // lines from source in one batch.
+                virtual void getlines(const int* line_numbers, int n,
+                                      LineBatch* lines);
+
+                long long getHits() const { return hits_; }
+                long long getMisses() const { return misses_; }
+                size_t getCachedBytes() const { return small_bytes_ + main_bytes_; }
+                size_t getCapacity() const { return capacity_bytes_; }
+        private:
+                struct Entry
+                {
+                        std::string line;
+                        unsigned char frequency;    // reads while cached, max 3
+                        bool in_main;
+                };
+
+                const std::string* lookup(int line_number);
+                void insert(int line_number, const char* data, size_t length);
+                void evict();
+                void evictSmall();
+                void evictMain();
+                void remember(int line_number);
+                size_t cost(const Entry& entry) const;
+
+                RandomLineAccessInterface* source_;
+                size_t capacity_bytes_;
+                size_t small_capacity_bytes_;
+                std::unordered_map<int, Entry> entries_;
+                std::deque<int> small_;     // probation, oldest at the front
+                std::deque<int> main_;
+                size_t small_bytes_;
+                size_t main_bytes_;
+
+                // Lines recently evicted from probation. A miss on one of
+                // them goes straight to main_. Each is tagged with the
+                // sequence number of its insertion so stale queue entries
+                // can be recognised.
+                std::unordered_map<int, unsigned long long> ghosts_;
+                std::deque<std::pair<int, unsigned long long> > ghost_queue_;
+                unsigned long long ghost_sequence_;
+
+                long long hits_;
+                long long misses_;
+                std::vector<int> missing_;  // getlines() scratch
+                LineBatch fetched_;
+                DISALLOW_COPY_AND_ASSIGN(CachedLineAccess);
+};
+
+#endif
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Page level allocation for large bit arrays
+ *
+ * Documentation available in pagealloc.h.
+*******************************************************************************/
+
+#include <algorithm>    /* find */
+#include <cstdlib>      /* atoi */
+#include <cstring>      /* memset */
+#include <fstream>      /* ifstream */
+#include <map>          /* map */
+#include <mutex>        /* mutex, lock_guard */
+#include <sstream>      /* istringstream */
+#include <string>       /* string, getline */
+#include <vector>       /* vector */
+#include "pagealloc.h"
+
+#if defined(__linux__)
+#include <sched.h>          /* sched_setaffinity, CPU_SET */
+#include <sys/mman.h>       /* mmap, madvise, munmap */
+#include <sys/syscall.h>    /* SYS_mbind, SYS_getcpu */
+#include <unistd.h>         /* syscall */
+
+// From <linux/mman.h> and <numaif.h>, which are not always installed.
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#endif
+
+static const size_t SMALL_PAGE = size_t(4) << 10;
+static const size_t HUGE_PAGE_2MB = size_t(2) << 20;
+static const size_t HUGE_PAGE_1GB = size_t(1) << 30;
+
+static size_t roundUp(size_t bytes, size_t unit)
+{
+        return (bytes + unit - 1) / unit * unit;
+}
+
+// The length of every live mapping, by address. Which fallback succeeded
+// decides the length (a 1 GB page request which ends up on 4 KB pages is
+// rounded to 4 KB), and freePages() must unmap exactly that.
+static std::mutex mapping_mutex;
+static std::map<void*, size_t>& mappingLengths()
+{
+        static std::map<void*, size_t> lengths;
+        return lengths;
+}
+// Parses a kernel cpu or node list such as "0-3,8,10-11".
+static std::vector<int> parseList(const std::string& list)
+{
+        std::vector<int> values;
+        std::istringstream ranges(list);
+        std::string range;
+        while(std::getline(ranges, range, ','))
+        {
+                if(range.empty())
+                        continue;
+                size_t dash = range.find('-');
+                int first = std::atoi(range.c_str());
+                int last = dash == std::string::npos ? first :
+                           std::atoi(range.c_str() + dash + 1);
+                for(int value = first; value <= last; ++value)
+                        values.push_back(value);
+        }
+        return values;
+}
+
+static std::string readFirstLine(const std::string& path)
+{
+        std::ifstream file(path.c_str());
+        std::string line;
+        std::getline(file, line);
+        return line;
+}
+
+std::vector<int> onlineNumaNodes()
+{
+        std::vector<int> nodes = parseList(
+                        readFirstLine("/sys/devices/system/node/online"));
+        if(nodes.empty())
+                nodes.push_back(0);
+        return nodes;
+}
+
+int numaNodeCount()
+{
+        return (int) onlineNumaNodes().size();
+}
+
+int currentNumaNode()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+                return (int) node;
+#endif
+        return 0;
+}
+
+bool pinThreadToNode(int node)
+{
+#if defined(__linux__)
+        std::ostringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        std::vector<int> cpus = parseList(readFirstLine(path.str()));
+        if(cpus.empty())
+                return false;
+
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for(size_t i = 0; i < cpus.size(); ++i)
+                CPU_SET(cpus[i], &mask);
+        return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+#else
+        return false;
+#endif
+}
+
+#if defined(__linux__)
+// Applies the NUMA part of policy to a fresh, untouched mapping. Pages are
+// only placed when first touched, so this must happen before any write.
+// Failure (no NUMA support, node offline) leaves the default placement.
+static void placePages(void* pages, size_t length, const AllocationPolicy& policy)
+{
+#if defined(SYS_mbind)
+        if(policy.placement == NUMA_DEFAULT)
+                return;
+
+        const int bits_per_mask = 8 * sizeof(unsigned long);
+        std::vector<int> nodes = onlineNumaNodes();
+        std::vector<unsigned long> mask(nodes.back() / bits_per_mask + 1, 0);
+        int mode = MPOL_INTERLEAVE;
+
+        if(policy.placement == NUMA_BIND)
+        {
+                if(std::find(nodes.begin(), nodes.end(), policy.numa_node) ==
+                   nodes.end())
+                        return;
+                mode = MPOL_BIND;
+                mask[policy.numa_node / bits_per_mask] |=
+                                1UL << (policy.numa_node % bits_per_mask);
+        }
+        else
+        {
+                for(size_t i = 0; i < nodes.size(); ++i)
+                        mask[nodes[i] / bits_per_mask] |=
+                                        1UL << (nodes[i] % bits_per_mask);
+        }
+
+        syscall(SYS_mbind, pages, length, mode, &mask[0],
+                (unsigned long) (mask.size() * bits_per_mask), 0);
+#endif
+}
+#endif
+
+// Tries, in order: the explicit huge page size requested, 2 MB huge pages,
+// then normal pages advised to become transparent huge pages. Explicit huge
+// pages only succeed if the administrator reserved them (vm.nr_hugepages or
+// hugepagesz=1G on the kernel command line). MAP_NORESERVE must not be used:
+// a huge page mapping would then succeed without pages behind it and the
+// first touch would raise SIGBUS instead of falling back.
+void* allocatePages(size_t bytes, const AllocationPolicy& policy)
+{
+#if defined(__linux__)
+        const int protection = PROT_READ | PROT_WRITE;
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void* pages = MAP_FAILED;
+        size_t length = 0;
+
+        if(policy.huge_pages == HUGE_PAGES_1GB)
+        {
+                length = roundUp(bytes, HUGE_PAGE_1GB);
+                pages = mmap(NULL, length, protection,
+                             flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        }
+        if(pages == MAP_FAILED && (policy.huge_pages == HUGE_PAGES_1GB ||
+                                   policy.huge_pages == HUGE_PAGES_2MB))
+        {
+                length = roundUp(bytes, HUGE_PAGE_2MB);
+                pages = mmap(NULL, length, protection,
+                             flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        }
+        if(pages == MAP_FAILED)
+        {
+                length = roundUp(bytes, SMALL_PAGE);
+                pages = mmap(NULL, length, protection, flags, -1, 0);
+                if(pages == MAP_FAILED)
+                        throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+                if(policy.huge_pages != HUGE_PAGES_NONE)
+                        madvise(pages, length, MADV_HUGEPAGE);
+#endif
+        }
+
+        try
+        {
+                std::lock_guard<std::mutex> lock(mapping_mutex);
+                mappingLengths()[pages] = length;
+        }
+        catch(...)
+        {
+                munmap(pages, length);
+                throw;
+        }
+
+        placePages(pages, length, policy);
+        return pages;
+#else
+        void* pages = ::operator new(bytes);
+        std::memset(pages, 0, bytes);
+        return pages;
+#endif
+}
+
+void freePages(void* pages, size_t bytes)
+{
+        if(pages == NULL)
+                return;
+#if defined(__linux__)
+        size_t length = roundUp(bytes, SMALL_PAGE);
+        {
+                std::lock_guard<std::mutex> lock(mapping_mutex);
+                std::map<void*, size_t>::iterator mapping =
+                                mappingLengths().find(pages);
+                if(mapping != mappingLengths().end())
+                {
+                        length = mapping->second;
+                        mappingLengths().erase(mapping);
+                }
+        }
+        munmap(pages, length);
+#else
+        ::operator delete(pages);
+#endif
+}
@@ -0,0 +1,216 @@
+/*******************************************************************************
+ * Page level allocation for large bit arrays
+ *
+ * A Bloom Filter of several GB probed at random misses the TLB on nearly every
+ * probe when it sits on 4 KB pages, and on multi-socket machines half of the
+ * probes land on the remote socket's memory. PageAllocator maps bit arrays
+ * directly from the kernel so they can be backed by 2 MB or 1 GB huge pages
+ * and placed on, or interleaved across, NUMA nodes. Every request falls back
+ * gracefully: explicit huge pages -> transparent huge pages -> normal pages,
+ * and NUMA placement is skipped on machines (or kernels) without it.
+*******************************************************************************/
+
+#include <cstddef>      /* size_t */
+#include <new>          /* bad_alloc, placement new */
+#include <type_traits>  /* is_trivially_default_constructible */
+#include <utility>      /* forward */
+#include <vector>       /* vector */
+#include "macros.h"
+
+#ifndef PAGE_ALLOC_H_
+#define PAGE_ALLOC_H_
+
+enum HugePages
+{
+        HUGE_PAGES_NONE,            // whatever the system allocator does
+        HUGE_PAGES_TRANSPARENT,     // madvise(MADV_HUGEPAGE)
+        HUGE_PAGES_2MB,             // MAP_HUGETLB, 2 MB pages
+        HUGE_PAGES_1GB              // MAP_HUGETLB, 1 GB pages
+};
+
+enum NumaPlacement
+{
+        NUMA_DEFAULT,               // first touch
+        NUMA_INTERLEAVE,            // pages spread round robin over all nodes
+        NUMA_BIND                   // pages on numa_node only
+};
+
+// How PageAllocator should obtain memory. The default policy behaves like
+// the standard allocator.
+struct AllocationPolicy
+{
+        AllocationPolicy(HugePages huge_pages = HUGE_PAGES_NONE,
+                         NumaPlacement placement = NUMA_DEFAULT,
+                         int numa_node = 0)
+                : huge_pages(huge_pages), placement(placement),
+                  numa_node(numa_node) {}
+
+        HugePages huge_pages;
+        NumaPlacement placement;
+        int numa_node;              // NUMA_BIND only
+};
+
+// Returns at least bytes bytes of zeroed memory obtained according to
+// policy, mapped in whole pages of the size actually obtained. Throws
+// std::bad_alloc if even the final fallback fails. The memory must be
+// released with freePages() and the same bytes.
+void* allocatePages(size_t bytes, const AllocationPolicy& policy);
+void freePages(void* pages, size_t bytes);
+
+// Ids of the NUMA nodes the kernel reports online, ascending ({0} if
+// unknown). Ids need not be contiguous.
+std::vector<int> onlineNumaNodes();
+
+// Number of NUMA nodes online (1 if unknown).
+int numaNodeCount();
+
+// NUMA node of the CPU the calling thread is running on (0 if unknown).
+int currentNumaNode();
+
+// Restricts the calling thread to the CPUs of node. Returns false if the
+// node's CPUs cannot be determined or the affinity cannot be set.
+bool pinThreadToNode(int node);
+
+// A standard allocator which obtains its memory through allocatePages().
+// Small requests (under one page) go to operator new, since mapping them
+// would waste most of a page.
+//
+// A fresh mapping is already zero, and writing zeros over it would touch
+// (and so fault in and place) every page before its first real use. The
+// allocator therefore remembers how much of its latest mapping has never
+// been constructed into, and value initialization (resize(), or the count
+// constructor) of a trivial T there writes nothing. Everywhere else,
+// including memory a shrunk vector grows back into, it writes as usual.
+// Only the allocator which made a mapping knows this: copies start without
+// it, and a move or swap carries it along with the buffer.
+//      Example usage:
+//          std::vector<bitword, PageAllocator<bitword> >
+//                  words(PageAllocator<bitword>(AllocationPolicy(HUGE_PAGES_2MB)));
+//          words.resize(count);    // all zero, no page touched
+template <class T>
+class PageAllocator
+{
+        public:
+                typedef T value_type;
+                typedef std::true_type propagate_on_container_swap;
+                typedef std::true_type propagate_on_container_move_assignment;
+
+                PageAllocator() : fresh_(NULL), fresh_end_(NULL) {}
+                explicit PageAllocator(const AllocationPolicy& policy)
+                        : policy_(policy), fresh_(NULL), fresh_end_(NULL) {}
+                PageAllocator(const PageAllocator& other)
+                        : policy_(other.policy_), fresh_(NULL), fresh_end_(NULL) {}
+                PageAllocator(PageAllocator&& other)
+                        : policy_(other.policy_), fresh_(other.fresh_),
+                          fresh_end_(other.fresh_end_)
+                {
+                        other.fresh_ = NULL;
+                        other.fresh_end_ = NULL;
+                }
+                template <class U>
+                PageAllocator(const PageAllocator<U>& other)
+                        : policy_(other.getPolicy()), fresh_(NULL), fresh_end_(NULL) {}
+
+                PageAllocator& operator=(const PageAllocator& other)
+                {
+                        policy_ = other.policy_;
+                        fresh_ = NULL;
+                        fresh_end_ = NULL;
+                        return *this;
+                }
+                PageAllocator& operator=(PageAllocator&& other)
+                {
+                        policy_ = other.policy_;
+                        fresh_ = other.fresh_;
+                        fresh_end_ = other.fresh_end_;
+                        if(&other != this)
+                        {
+                                other.fresh_ = NULL;
+                                other.fresh_end_ = NULL;
+                        }
+                        return *this;
+                }
+
+                T* allocate(size_t count)
+                {
+                        size_t bytes = count * sizeof(T);
+                        if(!isMapped(bytes))
+                                return static_cast<T*>(::operator new(bytes));
+                        T* pages = static_cast<T*>(allocatePages(bytes, policy_));
+                        fresh_ = reinterpret_cast<char*>(pages);
+                        fresh_end_ = reinterpret_cast<char*>(pages + count);
+                        return pages;
+                }
+
+                void deallocate(T* pointer, size_t count)
+                {
+                        size_t bytes = count * sizeof(T);
+                        if(fresh_end_ == reinterpret_cast<char*>(pointer + count))
+                        {
+                                fresh_ = NULL;
+                                fresh_end_ = NULL;
+                        }
+                        if(!isMapped(bytes))
+                                ::operator delete(pointer);
+                        else
+                                freePages(pointer, bytes);
+                }
+
+                template <class U>
+                void construct(U* pointer)
+                {
+                        if(isFresh(pointer, sizeof(U)) &&
+                           std::is_trivially_default_constructible<U>::value)
+                                return;     // already zero, leave it untouched
+                        ::new((void*) pointer) U();
+                }
+                template <class U, class... Args>
+                void construct(U* pointer, Args&&... args)
+                {
+                        isFresh(pointer, sizeof(U));
+                        ::new((void*) pointer) U(std::forward<Args>(args)...);
+                }
+
+                const AllocationPolicy& getPolicy() const { return policy_; }
+
+                template <class U>
+                bool operator==(const PageAllocator<U>& other) const
+                {
+                        return policy_.huge_pages == other.getPolicy().huge_pages &&
+                               policy_.placement == other.getPolicy().placement &&
+                               policy_.numa_node == other.getPolicy().numa_node;
+                }
+                template <class U>
+                bool operator!=(const PageAllocator<U>& other) const
+                {
+                        return !(*this == other);
+                }
+        private:
+                static const size_t SMALL_ALLOCATION = 4096;
+
+                bool isMapped(size_t bytes) const
+                {
+                        return (policy_.huge_pages != HUGE_PAGES_NONE ||
+                                policy_.placement != NUMA_DEFAULT) &&
+                               bytes >= SMALL_ALLOCATION;
+                }
+
+                // True if the size bytes at pointer have never been
+                // constructed into since they were mapped. Everything up to
+                // a construction stops counting as fresh, so memory which was
+                // skipped once is written the next time.
+                bool isFresh(void* pointer, size_t size)
+                {
+                        char* at = static_cast<char*>(pointer);
+                        if(fresh_ == NULL || at < fresh_ || at >= fresh_end_)
+                                return false;
+                        fresh_ = at + size;
+                        return true;
+                }
+
+                AllocationPolicy policy_;
+                char* fresh_;           // [fresh_, fresh_end_) is still zero
+                char* fresh_end_;
+};
+
+#endif
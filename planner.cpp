@@ -0,0 +1,319 @@
+/*******************************************************************************
+ * Bloom Filter planner
+ *
+ * Documentation available in planner.h.
+*******************************************************************************/
+
+#include <chrono>       /* steady_clock */
+#include <algorithm>    /* min */
+#include <cmath>        /* ceil, exp, ldexp, log, pow */
+#include <cstdlib>      /* rand */
+#include <iostream>     /* cout */
+#include <stdexcept>    /* invalid_argument */
+#include <vector>       /* vector */
+#include "fprmeasure.h"
+#include "planner.h"
+
+const char* filterLayoutName(FilterLayout layout)
+{
+        return layout == LAYOUT_BLOCKED ? "blocked" : "standard";
+}
+
+void printFilterPlan(const FilterPlan& plan)
+{
+        std::cout << "layout          = " << filterLayoutName(plan.layout)
+                  << std::endl
+                  << "bitarray (m)    = " << plan.bitarray_length << " bits ("
+                  << (plan.bitarray_length + 7) / 8 << " bytes)" << std::endl
+                  << "lenfact (m/n)   = "
+                  << (double) plan.bitarray_length / plan.key_count << std::endl
+                  << "hashcount (k)   = " << plan.hashcount << std::endl
+                  << "expected FPR    = " << plan.expected_fpr << std::endl;
+        if(plan.expected_query_ns > 0)
+                std::cout << "query cost      = " << plan.expected_query_ns
+                          << " ns" << (plan.meets_latency_budget ? "" :
+                                       " (over latency budget)") << std::endl;
+}
+
+FilterPlanner::FilterPlanner() : calibrated_(false)
+{
+        for(int layout = 0; layout < FILTER_LAYOUT_COUNT; ++layout)
+                for(int k = 0; k <= BloomFilter::MAX_HASH_COUNT; ++k)
+                        query_ns_[layout][k] = 0;
+}
+
+// Loads a few hundred thousand random words and then queries them back, so
+// every query evaluates all k hashes (the worst case a latency budget has to
+// allow for). The filter is otherwise nearly empty: only the probe pattern
+// and the bit array's size matter to the cost being measured. The query
+// results are accumulated so the compiler cannot discard the loop.
+//
+// Cost grows about linearly in k, so beyond the hash functions themselves
+// only every few k are timed and the ones between are interpolated; timing
+// all MAX_HASH_COUNT of them would take seconds.
+void FilterPlanner::calibrate(hash calibration_bits)
+{
+        const int probe_count = 1 << 18;
+        std::vector<std::string> probes(probe_count);
+        for(int i = 0; i < probe_count; ++i)
+                probes[i] = randomWord(8);
+
+        std::vector<int> timed;     // hash counts measured, ascending
+        for(int k = 1; k <= BloomFilter::MAX_HASH_COUNT;
+            k += k < HashMonster::hashFunctionCount + 1 ? 1 : 4)
+                timed.push_back(k);
+        if(timed.back() != BloomFilter::MAX_HASH_COUNT)
+                timed.push_back(BloomFilter::MAX_HASH_COUNT);
+
+        long long positives = 0;
+        for(int layout = 0; layout < FILTER_LAYOUT_COUNT; ++layout)
+        {
+                for(size_t t = 0; t < timed.size(); ++t)
+                {
+                        int k = timed[t];
+                        BloomFilter bloom(calibration_bits, k,
+                                          (FilterLayout) layout);
+                        for(int i = 0; i < probe_count; ++i)
+                                bloom.load(probes[i]);
+
+                        std::chrono::steady_clock::time_point start =
+                                        std::chrono::steady_clock::now();
+                        for(int i = 0; i < probe_count; ++i)
+                                positives += bloom.query(probes[i]);
+                        std::chrono::duration<double, std::nano> elapsed =
+                                        std::chrono::steady_clock::now() - start;
+
+                        query_ns_[layout][k] = elapsed.count() / probe_count;
+                }
+
+                for(size_t t = 1; t < timed.size(); ++t)
+                {
+                        int low = timed[t - 1];
+                        int high = timed[t];
+                        for(int k = low + 1; k < high; ++k)
+                                query_ns_[layout][k] = query_ns_[layout][low] +
+                                        (query_ns_[layout][high] -
+                                         query_ns_[layout][low]) *
+                                        (k - low) / (high - low);
+                }
+        }
+
+        if(positives != (long long) probe_count * FILTER_LAYOUT_COUNT *
+                        (long long) timed.size())
+                std::cerr << "FilterPlanner::calibrate: a loaded key was not "
+                             "recognized. This indicates a problem with the "
+                             "bloom filter." << std::endl;
+
+        calibrated_ = true;
+}
+
+bool FilterPlanner::isCalibrated() const
+{
+        return calibrated_;
+}
+
+// Returns the calibrated nanoseconds per query, or 0 if not calibrated.
+double FilterPlanner::getQueryCost(FilterLayout layout, int hashcount) const
+{
+        if(hashcount < 1 || hashcount > BloomFilter::MAX_HASH_COUNT)
+                return 0;
+        return query_ns_[layout][hashcount];
+}
+
+FilterPlan FilterPlanner::makePlan(long long key_count, hash bitarray_length,
+                                   int hashcount, FilterLayout layout,
+                                   double latency_budget_ns) const
+{
+        FilterPlan plan;
+        plan.key_count = key_count;
+        plan.bitarray_length = bitarray_length;
+        plan.hashcount = hashcount;
+        plan.layout = layout;
+        plan.expected_fpr = theoreticalFalsePositiveRate(bitarray_length,
+                                                         hashcount,
+                                                         key_count,
+                                                         layout);
+        plan.expected_query_ns = getQueryCost(layout, hashcount);
+        plan.meets_latency_budget = !calibrated_ || latency_budget_ns <= 0 ||
+                                    plan.expected_query_ns <= latency_budget_ns;
+        return plan;
+}
+
+// Candidates within the latency budget always beat those outside it; among
+// those outside it the fastest wins. Otherwise the smaller filter (or the
+// lower rate, when memory is fixed) wins, with query cost breaking ties.
+bool FilterPlanner::isBetter(const FilterPlan& candidate,
+                             const FilterPlan& best,
+                             bool prefer_small) const
+{
+        if(candidate.meets_latency_budget != best.meets_latency_budget)
+                return candidate.meets_latency_budget;
+
+        if(!candidate.meets_latency_budget)
+                return candidate.expected_query_ns < best.expected_query_ns;
+
+        if(prefer_small && candidate.bitarray_length != best.bitarray_length)
+                return candidate.bitarray_length < best.bitarray_length;
+        if(!prefer_small && candidate.expected_fpr != best.expected_fpr)
+                return candidate.expected_fpr < best.expected_fpr;
+
+        return candidate.expected_query_ns < best.expected_query_ns;
+}
+
+// The standard layout has a closed form: m = -kn / ln(1 - p^(1/k)). The
+// blocked layout does not, so its length is found by doubling from the
+// standard length and then bisecting over whole blocks.
+FilterPlan FilterPlanner::planForFalsePositiveRate(long long key_count,
+                                                   double target_fpr,
+                                                   double latency_budget_ns) const
+{
+        if(key_count <= 0)
+                throw std::invalid_argument("A plan requires at least one key.");
+        if(target_fpr <= 0 || target_fpr >= 1)
+                throw std::invalid_argument("The target false positive rate must lie between 0 and 1.");
+
+        FilterPlan best;
+        bool have_best = false;
+        for(int k = 1; k <= BloomFilter::MAX_HASH_COUNT; ++k)
+        {
+                double standard = std::ceil(-k * (double) key_count /
+                                std::log(1.0 - std::pow(target_fpr, 1.0 / k)));
+                hash standard_length = standard < 1 ? 1 : (hash) standard;
+
+                hash low = 1;
+                hash high = (standard_length + BLOOM_BLOCK_BITS - 1) /
+                                                        BLOOM_BLOCK_BITS;
+                for(int i = 0; i < 64 && theoreticalFalsePositiveRate(
+                                high * BLOOM_BLOCK_BITS, k, key_count,
+                                LAYOUT_BLOCKED) > target_fpr; ++i)
+                {
+                        low = high;
+                        high *= 2;
+                }
+                while(low < high)
+                {
+                        hash middle = low + (high - low) / 2;
+                        if(theoreticalFalsePositiveRate(
+                                        middle * BLOOM_BLOCK_BITS, k,
+                                        key_count, LAYOUT_BLOCKED) > target_fpr)
+                                low = middle + 1;
+                        else
+                                high = middle;
+                }
+
+                FilterPlan candidates[FILTER_LAYOUT_COUNT] = {
+                        makePlan(key_count, standard_length, k,
+                                 LAYOUT_STANDARD, latency_budget_ns),
+                        makePlan(key_count, high * BLOOM_BLOCK_BITS, k,
+                                 LAYOUT_BLOCKED, latency_budget_ns)
+                };
+                for(int c = 0; c < FILTER_LAYOUT_COUNT; ++c)
+                {
+                        if(!have_best || isBetter(candidates[c], best, true))
+                        {
+                                best = candidates[c];
+                                have_best = true;
+                        }
+                }
+        }
+        return best;
+}
+
+// Expected size of the FilterCodec encoding: every set bit costs its Rice
+// code (see riceParameter() in filtercodec.cpp) at the expected fill,
+// 1 - e^(-kn/m), and the codec writes raw words once that exceeds m.
+static double expectedCodedBits(hash bitarray_length, int hashcount,
+                                long long key_count)
+{
+        double m = (double) bitarray_length;
+        double fill = 1 - std::exp(-hashcount * (double) key_count / m);
+        if(fill <= 0)
+                return 0;
+
+        double best = m;
+        for(int parameter = 0; parameter <= 56; ++parameter)
+        {
+                double r = std::pow(1 - fill, std::ldexp(1.0, parameter));
+                best = std::min(best, m * fill * (parameter + 1 + r / (1 - r)));
+        }
+        return best;
+}
+
+// The shortest standard filter for a given k is also its smallest encoding
+// (a longer array adds code length faster than it removes set bits), so
+// only each k's closed form length needs comparing.
+FilterPlan FilterPlanner::planForTransmission(long long key_count,
+                                              double target_fpr,
+                                              double max_expansion) const
+{
+        if(key_count <= 0)
+                throw std::invalid_argument("A plan requires at least one key.");
+        if(target_fpr <= 0 || target_fpr >= 1)
+                throw std::invalid_argument("The target false positive rate must lie between 0 and 1.");
+        if(max_expansion < 1)
+                throw std::invalid_argument("A transmission plan may not be shorter than the smallest filter.");
+
+        std::vector<hash> lengths(BloomFilter::MAX_HASH_COUNT + 1);
+        hash shortest = 0;
+        for(int k = 1; k <= BloomFilter::MAX_HASH_COUNT; ++k)
+        {
+                double length = std::ceil(-k * (double) key_count /
+                                std::log(1.0 - std::pow(target_fpr, 1.0 / k)));
+                lengths[k] = length < 1 ? 1 : (hash) length;
+                if(shortest == 0 || lengths[k] < shortest)
+                        shortest = lengths[k];
+        }
+
+        int best_k = 0;
+        double best_bits = 0;
+        for(int k = 1; k <= BloomFilter::MAX_HASH_COUNT; ++k)
+        {
+                if(lengths[k] > max_expansion * (double) shortest)
+                        continue;
+                double bits = expectedCodedBits(lengths[k], k, key_count);
+                if(best_k == 0 || bits < best_bits)
+                {
+                        best_k = k;
+                        best_bits = bits;
+                }
+        }
+        return makePlan(key_count, lengths[best_k], best_k, LAYOUT_STANDARD, 0);
+}
+
+FilterPlan FilterPlanner::planForMemory(long long key_count,
+                                        unsigned long long memory_bytes,
+                                        double latency_budget_ns) const
+{
+        if(key_count <= 0)
+                throw std::invalid_argument("A plan requires at least one key.");
+        if(memory_bytes == 0)
+                throw std::invalid_argument("A plan requires at least one byte of memory.");
+
+        hash standard_length = (hash) memory_bytes * 8;
+        hash blocked_length = standard_length / BLOOM_BLOCK_BITS *
+                                                        BLOOM_BLOCK_BITS;
+
+        // A budget smaller than one block leaves only the standard layout.
+        int layout_count = blocked_length > 0 ? FILTER_LAYOUT_COUNT : 1;
+
+        FilterPlan best;
+        bool have_best = false;
+        for(int k = 1; k <= BloomFilter::MAX_HASH_COUNT; ++k)
+        {
+                FilterPlan candidates[FILTER_LAYOUT_COUNT] = {
+                        makePlan(key_count, standard_length, k,
+                                 LAYOUT_STANDARD, latency_budget_ns),
+                        makePlan(key_count, blocked_length, k,
+                                 LAYOUT_BLOCKED, latency_budget_ns)
+                };
+                for(int c = 0; c < layout_count; ++c)
+                {
+                        if(!have_best || isBetter(candidates[c], best, false))
+                        {
+                                best = candidates[c];
+                                have_best = true;
+                        }
+                }
+        }
+        return best;
+}
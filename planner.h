@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Bloom Filter planner
+ *
+ * Picks the bit array length (m), hash count (k) and layout of a Bloom Filter
+ * from the number of keys it must hold and either a memory budget or a target
+ * false positive rate. An optional latency budget rules out configurations
+ * which are too slow to query on this host, as measured by calibrate().
+*******************************************************************************/
+
+#include <string>       /* string */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+// A recommended Bloom Filter configuration. Pass it straight to the
+// BloomFilter(const FilterPlan&) constructor.
+struct FilterPlan
+{
+        long long key_count;        // n the plan was made for
+        hash bitarray_length;       // m
+        int hashcount;              // k
+        FilterLayout layout;
+        double expected_fpr;        // theoretical rate for n keys
+        double expected_query_ns;   // calibrated cost, 0 if not calibrated
+        bool meets_latency_budget;  // false => fastest candidate returned
+};
+
+// Returns "standard" or "blocked".
+const char* filterLayoutName(FilterLayout layout);
+
+// Prints a plan in the same style as main()'s lenfact/hashcount header.
+void printFilterPlan(const FilterPlan& plan);
+
+// Chooses among every layout and every k from 1 to
+// BloomFilter::MAX_HASH_COUNT (the optimal k, ln 2 * m/n, is about 10 for a
+// 0.1% rate). The theoretical false positive rates come from
+// theoreticalFalsePositiveRate() (fprmeasure.h); query costs come from a
+// microbenchmark run by calibrate(). Without calibration, latency budgets
+// are ignored and plans report an expected_query_ns of 0.
+//      Example usage:
+//          FilterPlanner planner;
+//          planner.calibrate();
+//          FilterPlan plan = planner.planForFalsePositiveRate(n, 0.001, 80);
+//          BloomFilter bloom(plan);
+class FilterPlanner
+{
+        public:
+                FilterPlanner();
+
+                // Times member queries against a filter of calibration_bits
+                // bits for every layout and hash count. Pick a size larger
+                // than the last level cache so the costs include memory
+                // latency, as they will for real filters.
+                void calibrate(hash calibration_bits = hash(1) << 28);
+                bool isCalibrated() const;
+                double getQueryCost(FilterLayout layout, int hashcount) const;
+
+                // Smallest filter with a theoretical rate <= target_fpr.
+                // latency_budget_ns <= 0 means no latency constraint.
+                FilterPlan planForFalsePositiveRate(long long key_count,
+                                                    double target_fpr,
+                                                    double latency_budget_ns = 0) const;
+
+                // Smallest expected FilterCodec encoding with a
+                // theoretical rate <= target_fpr, for filters written once
+                // and shipped. Fewer hashes and a longer, sparser bit array
+                // code smaller than the optimal k, whose array is half
+                // ones and incompressible (Mitzenmacher, "Compressed Bloom
+                // Filters", 2002), but the receiver holds the whole array,
+                // so it may be at most max_expansion times as long as the
+                // shortest one meeting the rate. Standard layout only.
+                FilterPlan planForTransmission(long long key_count,
+                                               double target_fpr,
+                                               double max_expansion = 8) const;
+
+                // Lowest theoretical rate achievable in memory_bytes. The
+                // blocked layout is only considered from one block (64
+                // bytes) up.
+                FilterPlan planForMemory(long long key_count,
+                                         unsigned long long memory_bytes,
+                                         double latency_budget_ns = 0) const;
+        private:
+                FilterPlan makePlan(long long key_count, hash bitarray_length,
+                                    int hashcount, FilterLayout layout,
+                                    double latency_budget_ns) const;
+                bool isBetter(const FilterPlan& candidate,
+                              const FilterPlan& best,
+                              bool prefer_small) const;
+
+                bool calibrated_;
+                double query_ns_[FILTER_LAYOUT_COUNT][BloomFilter::MAX_HASH_COUNT + 1];
+                DISALLOW_COPY_AND_ASSIGN(FilterPlanner);
+};
+
+#endif
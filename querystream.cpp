@@ -0,0 +1,427 @@
+/*******************************************************************************
+ * Streaming membership queries
+ *
+ * Documentation available in querystream.h.
+*******************************************************************************/
+
+#include <algorithm>    /* min, max */
+#include <chrono>       /* steady_clock */
+#include <condition_variable>   /* condition_variable */
+#include <cstring>      /* memchr, memcpy */
+#include <exception>    /* exception_ptr, current_exception, rethrow_exception */
+#include <ios>          /* ios_base::failure */
+#include <mutex>        /* mutex, unique_lock */
+#include <string>       /* string */
+#include <thread>       /* thread, hardware_concurrency */
+#include <vector>       /* vector */
+#include "querystream.h"
+
+// One worker's unit of input and its results. Blocks are reused for the
+// whole stream, so after the first few their buffers no longer allocate.
+struct StreamBlock
+{
+        std::vector<char> data;             // input, complete keys only
+        size_t length;                      // bytes of data in use
+        std::string matches;                // OUTPUT_MATCHES results
+        std::vector<unsigned char> bits;    // OUTPUT_BITMAP results
+        long long keys;
+        long long accepted;
+};
+
+// Splits the input into blocks that end on a key boundary. Whatever follows
+// the last '\n' is carried into the next block.
+class BlockReader
+{
+        public:
+                BlockReader(std::FILE* in, size_t block_bytes)
+                        : in_(in), block_bytes_(block_bytes), bytes_read_(0),
+                          at_end_(false) {}
+
+                // Fills block; returns false once the input is exhausted.
+                // A key longer than the block makes the block grow until
+                // the key fits.
+                bool fill(StreamBlock* block)
+                {
+                        if(block->data.size() < block_bytes_)
+                                block->data.resize(block_bytes_);
+
+                        size_t used = carry_.size();
+                        if(used >= block->data.size())
+                                block->data.resize(used * 2);
+                        if(used > 0)
+                                std::memcpy(&block->data[0], &carry_[0], used);
+                        carry_.clear();
+
+                        for(;;)
+                        {
+                                if(!at_end_)
+                                {
+                                        size_t got = std::fread(&block->data[used], 1,
+                                                        block->data.size() - used, in_);
+                                        bytes_read_ += got;
+                                        used += got;
+                                        if(used < block->data.size())
+                                        {
+                                                if(std::ferror(in_))
+                                                        throw std::ios_base::failure("Could not read keys.");
+                                                at_end_ = true;
+                                        }
+                                }
+
+                                size_t end = used;
+                                while(end > 0 && block->data[end - 1] != '\n')
+                                        --end;
+
+                                if(end > 0)
+                                {
+                                        carry_.assign(block->data.begin() + end,
+                                                      block->data.begin() + used);
+                                        block->length = end;
+                                        return true;
+                                }
+                                if(at_end_)
+                                {
+                                        block->length = used;
+                                        return used > 0;
+                                }
+                                block->data.resize(block->data.size() * 2);
+                        }
+                }
+
+                unsigned long long getBytesRead() const { return bytes_read_; }
+        private:
+                std::FILE* in_;
+                size_t block_bytes_;
+                std::vector<char> carry_;
+                unsigned long long bytes_read_;
+                bool at_end_;
+                DISALLOW_COPY_AND_ASSIGN(BlockReader);
+};
+
+// Queries every key of block. The key string is reused, so once it has grown
+// to the longest key no query allocates.
+static void queryBlock(const BloomFilter* bloom, StreamBlock* block,
+                       StreamOutput output)
+{
+        std::string key;
+        const char* position = block->length ? &block->data[0] : NULL;
+        const char* end = position + block->length;
+
+        block->matches.clear();
+        block->bits.clear();
+        block->keys = 0;
+        block->accepted = 0;
+
+        while(position < end)
+        {
+                const char* line_end = static_cast<const char*>(
+                                std::memchr(position, '\n', end - position));
+                if(line_end == NULL)
+                        line_end = end;     // unterminated final key
+
+                key.assign(position, line_end - position);
+                bool accepted = bloom->query(key);
+
+                if(output == OUTPUT_MATCHES)
+                {
+                        if(accepted)
+                        {
+                                block->matches.append(position,
+                                                      line_end - position);
+                                block->matches.push_back('\n');
+                        }
+                }
+                else
+                {
+                        if(block->keys % 8 == 0)
+                                block->bits.push_back(0);
+                        if(accepted)
+                                block->bits.back() |= 1 << (block->keys % 8);
+                }
+
+                block->keys++;
+                block->accepted += accepted;
+                position = line_end + 1;
+        }
+}
+
+// Worker threads started once per stream. start() hands them a batch of
+// blocks and returns at once; each worker claims the next unqueried block
+// until none are left, and wait() returns when the whole batch is done. An
+// exception thrown while querying (std::bad_alloc growing a result) would
+// end the program on a worker thread, so the worker keeps the batch's first
+// one for wait() to return and carries on with the next block.
+class QueryWorkers
+{
+        public:
+                QueryWorkers(const BloomFilter* bloom, StreamOutput output,
+                             int thread_count)
+                        : bloom_(bloom), output_(output), blocks_(NULL),
+                          count_(0), next_(0), done_(0), stopping_(false)
+                {
+                        try
+                        {
+                                for(int t = 0; t < thread_count; ++t)
+                                        threads_.push_back(std::thread(
+                                                &QueryWorkers::work, this));
+                        }
+                        catch(...)
+                        {
+                                stop();
+                                throw;
+                        }
+                }
+
+                ~QueryWorkers()
+                {
+                        stop();
+                }
+
+                void start(StreamBlock* blocks, int count)
+                {
+                        {
+                                std::lock_guard<std::mutex> lock(mutex_);
+                                blocks_ = blocks;
+                                count_ = count;
+                                next_ = 0;
+                                done_ = 0;
+                                error_ = std::exception_ptr();
+                        }
+                        started_.notify_all();
+                }
+
+                // Returns the first exception a worker caught in this batch,
+                // or an empty pointer.
+                std::exception_ptr wait()
+                {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        finished_.wait(lock, [this]() { return done_ == count_; });
+                        return error_;
+                }
+        private:
+                void work()
+                {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        for(;;)
+                        {
+                                started_.wait(lock, [this]()
+                                              { return stopping_ || next_ < count_; });
+                                if(next_ >= count_)
+                                        return;     // stopping
+
+                                StreamBlock* block = &blocks_[next_++];
+                                lock.unlock();
+                                std::exception_ptr error;
+                                try
+                                {
+                                        queryBlock(bloom_, block, output_);
+                                }
+                                catch(...)
+                                {
+                                        error = std::current_exception();
+                                }
+                                lock.lock();
+                                if(error && !error_)
+                                        error_ = error;
+                                if(++done_ == count_)
+                                        finished_.notify_all();
+                        }
+                }
+
+                void stop()
+                {
+                        {
+                                std::lock_guard<std::mutex> lock(mutex_);
+                                stopping_ = true;
+                        }
+                        started_.notify_all();
+                        for(size_t t = 0; t < threads_.size(); ++t)
+                                threads_[t].join();
+                        threads_.clear();
+                }
+
+                const BloomFilter* bloom_;
+                StreamOutput output_;
+                std::mutex mutex_;              // guards the members below
+                std::condition_variable started_;
+                std::condition_variable finished_;
+                StreamBlock* blocks_;           // the batch being queried
+                int count_;
+                int next_;                      // first unclaimed block
+                int done_;                      // blocks queried
+                std::exception_ptr error_;      // first failure this batch
+                bool stopping_;
+                std::vector<std::thread> threads_;
+                DISALLOW_COPY_AND_ASSIGN(QueryWorkers);
+};
+
+// Appends blocks' results to out in input order. Bitmaps of consecutive
+// blocks are spliced at bit granularity, holding back a partial final byte.
+class ResultWriter
+{
+        public:
+                ResultWriter(std::FILE* out, StreamOutput output)
+                        : out_(out), output_(output), pending_(0),
+                          pending_bits_(0) {}
+
+                void write(const StreamBlock& block)
+                {
+                        if(output_ == OUTPUT_MATCHES)
+                        {
+                                put(block.matches.data(), block.matches.size());
+                                return;
+                        }
+
+                        if(block.keys == 0)
+                                return;
+
+                        size_t whole = (size_t) (block.keys / 8);
+                        int tail = (int) (block.keys % 8);
+
+                        if(pending_bits_ == 0)
+                        {
+                                put(reinterpret_cast<const char*>(&block.bits[0]),
+                                    whole);
+                                if(tail)
+                                {
+                                        pending_ = block.bits[whole];
+                                        pending_bits_ = tail;
+                                }
+                                return;
+                        }
+
+                        scratch_.resize(whole + 1);
+                        size_t written = 0;
+                        for(size_t i = 0; i < block.bits.size(); ++i)
+                        {
+                                int available = i < whole ? 8 : tail;
+                                unsigned int merged = pending_ |
+                                                (block.bits[i] << pending_bits_);
+                                int total = pending_bits_ + available;
+                                if(total >= 8)
+                                {
+                                        scratch_[written++] = (char) (merged & 0xFF);
+                                        pending_ = (unsigned char) (merged >> 8);
+                                        pending_bits_ = total - 8;
+                                }
+                                else
+                                {
+                                        pending_ = (unsigned char) merged;
+                                        pending_bits_ = total;
+                                }
+                        }
+                        put(written ? &scratch_[0] : NULL, written);
+                }
+
+                void finish()
+                {
+                        if(pending_bits_ > 0)
+                        {
+                                char last = (char) pending_;
+                                put(&last, 1);
+                                pending_bits_ = 0;
+                        }
+                        if(std::fflush(out_) != 0)
+                                throw std::ios_base::failure("Could not write results.");
+                }
+        private:
+                void put(const char* data, size_t length)
+                {
+                        if(length > 0 && std::fwrite(data, 1, length, out_) != length)
+                                throw std::ios_base::failure("Could not write results.");
+                }
+
+                std::FILE* out_;
+                StreamOutput output_;
+                unsigned char pending_;
+                int pending_bits_;
+                std::vector<char> scratch_;
+                DISALLOW_COPY_AND_ASSIGN(ResultWriter);
+};
+
+// Two sets of blocks alternate: while the workers query one batch, this
+// thread reads the next, then writes the finished batch in order. Writing
+// is not overlapped with reading; with OUTPUT_BITMAP the results are an
+// eighth of a byte per key, and matches are usually few.
+StreamStatistics streamQueries(const BloomFilter& bloom,
+                               std::FILE* in,
+                               std::FILE* out,
+                               StreamOutput output,
+                               int thread_count,
+                               size_t block_bytes,
+                               size_t max_buffer_bytes)
+{
+        const size_t min_block_bytes = size_t(1) << 20;
+
+        if(thread_count <= 0)
+                thread_count = (int) std::thread::hardware_concurrency();
+        if(thread_count <= 0)
+                thread_count = 1;
+
+        // One block per worker in each of the two batches, as long as that
+        // fits in max_buffer_bytes.
+        int batch_blocks = thread_count;
+        size_t share = max_buffer_bytes / (2 * (size_t) batch_blocks);
+        if(block_bytes > share)
+                block_bytes = std::max(share, std::min(block_bytes, min_block_bytes));
+        if(2 * (size_t) batch_blocks * block_bytes > max_buffer_bytes)
+                batch_blocks = (int) std::max<size_t>(1,
+                                max_buffer_bytes / (2 * block_bytes));
+
+        std::chrono::steady_clock::time_point start =
+                        std::chrono::steady_clock::now();
+
+        BlockReader reader(in, block_bytes);
+        ResultWriter writer(out, output);
+        QueryWorkers workers(&bloom, output, batch_blocks);
+        std::vector<StreamBlock> batches[2];
+        batches[0].resize(batch_blocks);
+        batches[1].resize(batch_blocks);
+        int filled[2] = { 0, 0 };
+
+        StreamStatistics statistics;
+        statistics.keys = 0;
+        statistics.matches = 0;
+
+        while(filled[0] < batch_blocks && reader.fill(&batches[0][filled[0]]))
+                ++filled[0];
+
+        int current = 0;
+        while(filled[current] > 0)
+        {
+                workers.start(&batches[current][0], filled[current]);
+
+                int next = 1 - current;
+                filled[next] = 0;
+                try
+                {
+                        while(filled[next] < batch_blocks &&
+                              reader.fill(&batches[next][filled[next]]))
+                                ++filled[next];
+                }
+                catch(...)
+                {
+                        workers.wait();     // they are using batches[current]
+                        throw;
+                }
+
+                std::exception_ptr error = workers.wait();
+                if(error)
+                        std::rethrow_exception(error);
+
+                for(int t = 0; t < filled[current]; ++t)
+                {
+                        writer.write(batches[current][t]);
+                        statistics.keys += batches[current][t].keys;
+                        statistics.matches += batches[current][t].accepted;
+                }
+                current = next;
+        }
+        writer.finish();
+
+        std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+        statistics.bytes = reader.getBytesRead();
+        statistics.seconds = elapsed.count();
+        return statistics;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Streaming membership queries
+ *
+ * Answers membership for newline delimited keys read from a file or pipe,
+ * using a trained or persisted Bloom Filter. Input is read in large blocks,
+ * each block is split into keys and queried by a pool of worker threads, and
+ * results are written in input order. Keys are never copied into per-line
+ * allocations, so throughput is bounded by the input device and the filter's
+ * memory latency rather than by the allocator.
+*******************************************************************************/
+
+#include <cstdio>       /* FILE */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef QUERY_STREAM_H_
+#define QUERY_STREAM_H_
+
+enum StreamOutput
+{
+        OUTPUT_MATCHES,     // every key the filter accepts, one per line
+        OUTPUT_BITMAP       // one bit per input key (1 = accepted), packed
+                            // least significant bit first, zero padded
+};
+
+struct StreamStatistics
+{
+        long long keys;             // keys read
+        long long matches;          // keys the filter accepted
+        unsigned long long bytes;   // input bytes read
+        double seconds;             // wall clock time
+};
+
+// Reads keys from in until end of file and writes results to out. Keys are
+// split on '\n' only (see ON BLOOM FILTERS AND USAGE in bloom.h); a final
+// key without a line break is still queried. thread_count <= 0 uses one
+// worker per hardware thread; the workers live for the whole stream.
+// block_bytes is the unit of work handed to a worker; a block grows to fit
+// a key longer than itself. Two batches of blocks are in use at once, and
+// their input buffers are kept within max_buffer_bytes: blocks shrink to
+// share it (down to 1 MB), and below that fewer blocks are queried at a
+// time. Throws std::ios_base::failure on read or write errors, and rethrows
+// any exception a worker raised while querying.
+StreamStatistics streamQueries(const BloomFilter& bloom,
+                               std::FILE* in,
+                               std::FILE* out,
+                               StreamOutput output,
+                               int thread_count = 0,
+                               size_t block_bytes = size_t(16) << 20,
+                               size_t max_buffer_bytes = size_t(256) << 20);
+
+#endif
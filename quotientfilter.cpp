@@ -0,0 +1,403 @@
+/*******************************************************************************
+ * Quotient Filter
+ *
+ * Documentation available in quotientfilter.h.
+ *
+ * The table does not wrap around: a run that would spill past the last home
+ * slot continues into a few overflow slots instead. Slot 0 is then never
+ * shifted, and a forward scan meets fingerprints in sorted order.
+*******************************************************************************/
+
+#include <cmath>        /* sqrt */
+#include <stdexcept>    /* invalid_argument, length_error */
+#include <utility>      /* swap */
+#include "quotientfilter.h"
+
+static const double QF_MAX_LOAD = 0.75;     // load() grows beyond this
+static const double QF_MERGE_LOAD = 0.75;   // merge() sizes for this
+
+static bool testBit(const BitArray& bits, unsigned long long i)
+{
+        return (bits[i / BITS_PER_WORD] >> (i % BITS_PER_WORD) & 1) != 0;
+}
+
+static void assignBit(BitArray* bits, unsigned long long i, bool value)
+{
+        bitword mask = bitword(1) << (i % BITS_PER_WORD);
+        if(value)
+                (*bits)[i / BITS_PER_WORD] |= mask;
+        else
+                (*bits)[i / BITS_PER_WORD] &= ~mask;
+}
+
+static unsigned long long lowBits(int count)
+{
+        return count >= 64 ? ~0ULL : (1ULL << count) - 1;
+}
+
+// Runs overflow past the last home slot by about the length of the longest
+// cluster, which grows with the square root of the table size.
+QuotientFilter::QuotientFilter(int quotient_bits, int remainder_bits)
+        : quotient_bits_(quotient_bits),
+          remainder_bits_(remainder_bits),
+          entry_count_(0),
+          last_slot_(0),
+          last_quotient_(0),
+          last_remainder_(0)
+{
+        if(quotient_bits < 1 || remainder_bits < 1 ||
+           quotient_bits + remainder_bits > 64 || quotient_bits > 48)
+                throw std::invalid_argument("QuotientFilter: bad fingerprint size.");
+
+        canonical_slots_ = 1ULL << quotient_bits;
+        slot_count_ = canonical_slots_ + 64 +
+                        (unsigned long long) (10 * std::sqrt((double) canonical_slots_));
+
+        hash metadata_words = (hash) ((slot_count_ + BITS_PER_WORD - 1) / BITS_PER_WORD);
+        occupieds_.resize(metadata_words);      // all zero
+        continuations_.resize(metadata_words);
+        shifteds_.resize(metadata_words);
+        // One spare word so a remainder straddling the last word can be read
+        // with two loads.
+        remainders_.resize((hash) ((slot_count_ * remainder_bits + BITS_PER_WORD - 1) /
+                                   BITS_PER_WORD + 1));
+}
+
+bool QuotientFilter::isOccupied(unsigned long long slot) const
+{
+        return testBit(occupieds_, slot);
+}
+
+bool QuotientFilter::isContinuation(unsigned long long slot) const
+{
+        return testBit(continuations_, slot);
+}
+
+bool QuotientFilter::isShifted(unsigned long long slot) const
+{
+        return testBit(shifteds_, slot);
+}
+
+// A home slot is only occupied if it holds something, so an empty slot has
+// all three metadata bits clear.
+bool QuotientFilter::isEmpty(unsigned long long slot) const
+{
+        return !isOccupied(slot) && !isContinuation(slot) && !isShifted(slot);
+}
+
+unsigned long long QuotientFilter::getRemainder(unsigned long long slot) const
+{
+        unsigned long long bit = slot * remainder_bits_;
+        hash word = (hash) (bit / BITS_PER_WORD);
+        int offset = (int) (bit % BITS_PER_WORD);
+        unsigned long long value = remainders_[word] >> offset;
+        if(offset + remainder_bits_ > BITS_PER_WORD)
+                value |= remainders_[word + 1] << (BITS_PER_WORD - offset);
+        return value & lowBits(remainder_bits_);
+}
+
+void QuotientFilter::setRemainder(unsigned long long slot,
+                                  unsigned long long remainder)
+{
+        unsigned long long bit = slot * remainder_bits_;
+        hash word = (hash) (bit / BITS_PER_WORD);
+        int offset = (int) (bit % BITS_PER_WORD);
+        unsigned long long mask = lowBits(remainder_bits_);
+
+        remainders_[word] = (remainders_[word] & ~(mask << offset)) |
+                            (remainder << offset);
+        if(offset + remainder_bits_ > BITS_PER_WORD)
+        {
+                int shift = BITS_PER_WORD - offset;
+                remainders_[word + 1] = (remainders_[word + 1] & ~(mask >> shift)) |
+                                        (remainder >> shift);
+        }
+}
+
+// The quotient comes from the top bits of the hash, so it must be a wide,
+// well mixed one.
+unsigned long long QuotientFilter::fingerprint(const std::string& key) const
+{
+        unsigned long long h = HashMonster::wideHash(key);
+        int width = quotient_bits_ + remainder_bits_;
+        return width >= 64 ? h : h >> (64 - width);
+}
+
+// Finds where the run for quotient starts, or would start if quotient is
+// not occupied yet. Walks back to the start of the cluster, then forward
+// counting runs: the n-th occupied home slot of a cluster owns its n-th run.
+unsigned long long QuotientFilter::runStart(unsigned long long quotient) const
+{
+        unsigned long long home = quotient;
+        while(home > 0 && isShifted(home))
+                --home;
+
+        unsigned long long run = home;
+        while(home != quotient)
+        {
+                do
+                        ++run;
+                while(run < slot_count_ && isContinuation(run));
+
+                do
+                        ++home;
+                while(home != quotient && !isOccupied(home));
+        }
+        return run;
+}
+
+// Runs are kept sorted, so a lookup stops at the first larger remainder.
+bool QuotientFilter::query(const std::string& value) const
+{
+        unsigned long long f = fingerprint(value);
+        unsigned long long quotient = f >> remainder_bits_;
+        unsigned long long remainder = f & lowBits(remainder_bits_);
+
+        if(!isOccupied(quotient))
+                return false;
+
+        unsigned long long slot = runStart(quotient);
+        do
+        {
+                unsigned long long stored = getRemainder(slot);
+                if(stored == remainder)
+                        return true;
+                if(stored > remainder)
+                        return false;
+                ++slot;
+        }
+        while(slot < slot_count_ && isContinuation(slot));
+        return false;
+}
+
+// Inserts into the run for quotient, keeping it sorted, and shifts
+// everything up to the next empty slot right by one. Returns false, with the
+// filter unchanged, if the shift would run off the end of the table.
+// Occupied bits belong to home slots and never move; the other two move
+// with their remainders.
+bool QuotientFilter::insert(unsigned long long quotient,
+                            unsigned long long remainder)
+{
+        if(isEmpty(quotient))
+        {
+                setRemainder(quotient, remainder);
+                assignBit(&occupieds_, quotient, true);
+                ++entry_count_;
+                return true;
+        }
+
+        bool was_occupied = isOccupied(quotient);
+        unsigned long long start = runStart(quotient);
+        unsigned long long slot = start;
+        if(was_occupied)
+        {
+                do
+                {
+                        unsigned long long stored = getRemainder(slot);
+                        if(stored == remainder)
+                                return true;    // already present
+                        if(stored > remainder)
+                                break;
+                        ++slot;
+                }
+                while(slot < slot_count_ && isContinuation(slot));
+        }
+
+        unsigned long long empty = slot;
+        while(empty < slot_count_ && !isEmpty(empty))
+                ++empty;
+        if(empty == slot_count_)
+                return false;
+
+        assignBit(&occupieds_, quotient, true);
+        if(was_occupied && slot == start)
+                assignBit(&continuations_, start, true);   // old run head
+
+        for(unsigned long long i = empty; i > slot; --i)
+        {
+                setRemainder(i, getRemainder(i - 1));
+                assignBit(&continuations_, i, isContinuation(i - 1));
+                assignBit(&shifteds_, i, true);
+        }
+
+        setRemainder(slot, remainder);
+        assignBit(&continuations_, slot, was_occupied && slot != start);
+        assignBit(&shifteds_, slot, slot != quotient);
+        ++entry_count_;
+        return true;
+}
+
+// Each grow() briefly holds the old table and one twice its size.
+void QuotientFilter::load(const std::string& key)
+{
+        if(entry_count_ + 1 > QF_MAX_LOAD * canonical_slots_)
+                grow();
+
+        unsigned long long f = fingerprint(key);
+        while(!insert(f >> remainder_bits_, f & lowBits(remainder_bits_)))
+                grow();     // fingerprints keep their width, f stays valid
+}
+
+// Appends a fingerprint larger than any appended so far (equal ones are
+// dropped). Each goes in its home slot or just after the previous one, so
+// building a filter from a sorted stream touches every slot once.
+void QuotientFilter::append(unsigned long long quotient,
+                            unsigned long long remainder)
+{
+        bool same_run = entry_count_ > 0 && quotient == last_quotient_;
+        if(same_run && remainder == last_remainder_)
+                return;
+
+        unsigned long long slot = quotient;
+        if(entry_count_ > 0 && last_slot_ + 1 > slot)
+                slot = last_slot_ + 1;
+        if(slot >= slot_count_)
+                throw std::length_error("QuotientFilter: overflow slots exhausted.");
+
+        assignBit(&occupieds_, quotient, true);
+        setRemainder(slot, remainder);
+        assignBit(&continuations_, slot, same_run);
+        assignBit(&shifteds_, slot, slot != quotient);
+
+        last_slot_ = slot;
+        last_quotient_ = quotient;
+        last_remainder_ = remainder;
+        ++entry_count_;
+}
+
+// A cluster starts at an unshifted slot, whose run belongs to that slot.
+// Each later run in the cluster belongs to the next occupied home slot.
+bool QuotientFilter::Cursor::next(unsigned long long* fingerprint)
+{
+        while(slot_ < filter_.slot_count_ && filter_.isEmpty(slot_))
+                ++slot_;
+        if(slot_ >= filter_.slot_count_)
+                return false;
+
+        if(!filter_.isShifted(slot_))
+        {
+                quotient_ = slot_;
+        }
+        else if(!filter_.isContinuation(slot_))
+        {
+                do
+                        ++quotient_;
+                while(!filter_.isOccupied(quotient_));
+        }
+
+        *fingerprint = quotient_ << filter_.remainder_bits_ |
+                       filter_.getRemainder(slot_);
+        ++slot_;
+        return true;
+}
+
+void QuotientFilter::swap(QuotientFilter* other)
+{
+        std::swap(quotient_bits_, other->quotient_bits_);
+        std::swap(remainder_bits_, other->remainder_bits_);
+        std::swap(canonical_slots_, other->canonical_slots_);
+        std::swap(slot_count_, other->slot_count_);
+        std::swap(entry_count_, other->entry_count_);
+        occupieds_.swap(other->occupieds_);
+        continuations_.swap(other->continuations_);
+        shifteds_.swap(other->shifteds_);
+        remainders_.swap(other->remainders_);
+        std::swap(last_slot_, other->last_slot_);
+        std::swap(last_quotient_, other->last_quotient_);
+        std::swap(last_remainder_, other->last_remainder_);
+}
+
+// The fingerprints are streamed in order into a table twice the size and
+// the tables are exchanged; the old one is freed on return. Doubling in
+// place would not lower that peak, since growing the arrays reallocates
+// them anyway.
+void QuotientFilter::grow()
+{
+        if(remainder_bits_ <= 1)
+                throw std::length_error("QuotientFilter: no remainder bits left to grow.");
+
+        QuotientFilter larger(quotient_bits_ + 1, remainder_bits_ - 1);
+        unsigned long long mask = lowBits(larger.remainder_bits_);
+        unsigned long long f;
+        Cursor cursor(*this);
+        while(cursor.next(&f))
+                larger.append(f >> larger.remainder_bits_, f & mask);
+        swap(&larger);
+}
+
+// Truncating keeps the top bits, so both streams stay sorted and the merge
+// is a plain two-way merge.
+QuotientFilter* QuotientFilter::merge(const QuotientFilter& a,
+                                      const QuotientFilter& b)
+{
+        int width_a = a.quotient_bits_ + a.remainder_bits_;
+        int width_b = b.quotient_bits_ + b.remainder_bits_;
+        int width = width_a < width_b ? width_a : width_b;
+
+        int quotient_bits = a.quotient_bits_ > b.quotient_bits_ ?
+                        a.quotient_bits_ : b.quotient_bits_;
+        long long entries = a.entry_count_ + b.entry_count_;
+        while(entries > QF_MERGE_LOAD * (double) (1ULL << quotient_bits))
+                ++quotient_bits;
+        if(quotient_bits >= width)
+                throw std::length_error("QuotientFilter: merged filter has no remainder bits.");
+
+        QuotientFilter* merged = new QuotientFilter(quotient_bits,
+                                                    width - quotient_bits);
+        unsigned long long mask = lowBits(merged->remainder_bits_);
+        try
+        {
+                Cursor cursor_a(a), cursor_b(b);
+                unsigned long long fa = 0, fb = 0;
+                bool has_a = cursor_a.next(&fa);
+                bool has_b = cursor_b.next(&fb);
+                while(has_a || has_b)
+                {
+                        unsigned long long ta = fa >> (width_a - width);
+                        unsigned long long tb = fb >> (width_b - width);
+                        unsigned long long f;
+                        if(has_a && (!has_b || ta <= tb))
+                        {
+                                f = ta;
+                                has_a = cursor_a.next(&fa);
+                        }
+                        else
+                        {
+                                f = tb;
+                                has_b = cursor_b.next(&fb);
+                        }
+                        merged->append(f >> merged->remainder_bits_, f & mask);
+                }
+        }
+        catch(...)
+        {
+                delete merged;
+                throw;
+        }
+        return merged;
+}
+
+long long QuotientFilter::getEntryCount() const
+{
+        return entry_count_;
+}
+
+unsigned long long QuotientFilter::getSlotCount() const
+{
+        return canonical_slots_;
+}
+
+int QuotientFilter::getQuotientBits() const
+{
+        return quotient_bits_;
+}
+
+int QuotientFilter::getRemainderBits() const
+{
+        return remainder_bits_;
+}
+
+double QuotientFilter::getLoadFactor() const
+{
+        return (double) entry_count_ / (double) canonical_slots_;
+}
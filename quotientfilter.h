@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * Quotient Filter
+ *
+ * A BloomFilter's size is fixed when it is constructed: outgrowing it, or
+ * combining two filters, means retraining from the original keys. A quotient
+ * filter stores a p bit fingerprint of every key instead. The top q bits
+ * (the quotient) pick a home slot in a table of 2^q slots; the remaining
+ * r = p - q bits (the remainder) are stored in or near that slot, with three
+ * metadata bits per slot recording how runs of equal quotients have been
+ * shifted. Because the whole fingerprint can be recovered from the table,
+ * the filter can be doubled (one remainder bit moves into the quotient) and
+ * two filters can be merged without the keys. Fingerprints are stored in
+ * sorted order, so both are a single sequential pass, and lookups touch one
+ * short contiguous stretch of the table.
+ *
+ * (Bender et al., "Don't Thrash: How to Cache Your Hash on Flash", 2012.)
+*******************************************************************************/
+
+#include <string>       /* string */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef QUOTIENT_FILTER_H_
+#define QUOTIENT_FILTER_H_
+
+// Same load/query interface as BloomFilter. The false positive rate is about
+// load factor * 2^-r; load() doubles the table whenever the load factor
+// passes 0.75. Doubling moves a remainder bit into the quotient, so r drops
+// by one each time: at the same load factor the rate is twice what it was
+// before. (The fingerprint width p is kept, so the rate is about n * 2^-p
+// for n keys, and grows with them.) A filter which will double g times ends
+// near 2^g times its starting rate; give it g more remainder bits, or more
+// slots, to hold a target rate. Clusters, and with them every lookup and
+// insert, lengthen sharply as the table fills (roughly as 1 / (1 - load)^2),
+// so it is not allowed to fill further.
+//
+// Doubling builds the larger table beside the current one, so while it runs
+// the filter needs about three times its usual memory (the old table plus
+// one twice its size). Construct the filter big enough for the keys
+// expected if that peak matters.
+//      Example usage:
+//          QuotientFilter filter(16, 8);  // 65536 slots, 24 bit fingerprints
+//          filter.load("hello");
+//          filter.query("hello");      // true
+//          QuotientFilter* both = QuotientFilter::merge(filter, other);
+class QuotientFilter
+{
+        public:
+                // Walks the stored fingerprints in increasing order.
+                class Cursor
+                {
+                        public:
+                                explicit Cursor(const QuotientFilter& filter)
+                                        : filter_(filter), slot_(0), quotient_(0) {}
+                                // Returns false once every fingerprint has
+                                // been visited.
+                                bool next(unsigned long long* fingerprint);
+                        private:
+                                const QuotientFilter& filter_;
+                                unsigned long long slot_;
+                                unsigned long long quotient_;
+                                DISALLOW_COPY_AND_ASSIGN(Cursor);
+                };
+
+                // Throws std::invalid_argument unless quotient_bits and
+                // remainder_bits are at least 1 and sum to at most 64.
+                QuotientFilter(int quotient_bits, int remainder_bits);
+
+                void load(const std::string& key);
+                bool query(const std::string& value) const;
+
+                // Doubles the number of slots without the original keys.
+                // Fingerprints keep their width, so one bit moves from each
+                // remainder into its quotient. The new table is built before
+                // the old one is freed (see above for the memory this
+                // takes). Throws std::length_error when remainders are down
+                // to one bit.
+                void grow();
+
+                // Builds a new filter holding the fingerprints of a and b in
+                // one sequential pass over both. If their fingerprint widths
+                // differ the wider ones are truncated. The result is sized
+                // for a load factor of at most 0.75. Throws std::length_error
+                // if that leaves no remainder bits.
+                static QuotientFilter* merge(const QuotientFilter& a,
+                                             const QuotientFilter& b);
+
+                long long getEntryCount() const;
+                unsigned long long getSlotCount() const;   // 2^q
+                int getQuotientBits() const;
+                int getRemainderBits() const;
+                double getLoadFactor() const;
+        private:
+                friend class Cursor;
+
+                unsigned long long fingerprint(const std::string& key) const;
+                bool insert(unsigned long long quotient,
+                            unsigned long long remainder);
+                void append(unsigned long long quotient,
+                            unsigned long long remainder);
+                unsigned long long runStart(unsigned long long quotient) const;
+                void swap(QuotientFilter* other);
+
+                bool isOccupied(unsigned long long slot) const;
+                bool isContinuation(unsigned long long slot) const;
+                bool isShifted(unsigned long long slot) const;
+                bool isEmpty(unsigned long long slot) const;
+                unsigned long long getRemainder(unsigned long long slot) const;
+                void setRemainder(unsigned long long slot,
+                                  unsigned long long remainder);
+
+                int quotient_bits_;
+                int remainder_bits_;
+                unsigned long long canonical_slots_;    // 2^q
+                unsigned long long slot_count_;     // plus overflow slots
+                long long entry_count_;
+
+                // Bit i of each metadata array describes slot i. Slot i's
+                // remainder occupies bits [i * r, (i + 1) * r) of
+                // remainders_.
+                BitArray occupieds_;        // a key has quotient i
+                BitArray continuations_;    // not the first of its run
+                BitArray shifteds_;         // not in its home slot
+                BitArray remainders_;
+
+                // Position of the last append(), for sequential builds.
+                unsigned long long last_slot_;
+                unsigned long long last_quotient_;
+                unsigned long long last_remainder_;
+                DISALLOW_COPY_AND_ASSIGN(QuotientFilter);
+};
+
+#endif
@@ -1,9 +1,126 @@
 /*******************************************************************************
- * asdf
+ * Random access to the lines of a text file
+ *
+ * Documentation available in randomlineaccess.h.
 *******************************************************************************/
 
+#include <algorithm>    /* sort, max, min */
+#include <atomic>       /* atomic */
+#include <cerrno>       /* errno, EINTR */
+#include <cstring>      /* memchr, memcpy */
+#include <exception>    /* exception_ptr, current_exception */
+#include <stdexcept>    /* out_of_range */
+#include <thread>       /* thread */
 #include "randomlineaccess.h"
 
+#if !defined(_WIN32)
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* pread, close */
+#endif
+
+// FNV-1a over 64 bit words rather than bytes, with the tail folded in a
+// byte at a time. Every sampled region is hashed whole, so word boundaries
+// never depend on how the reads were split.
+static unsigned long long fingerprintBytes(unsigned long long fingerprint,
+                                           const char* data, size_t length)
+{
+        size_t i = 0;
+        for(; i + 8 <= length; i += 8)
+        {
+                unsigned long long word;
+                std::memcpy(&word, data + i, 8);
+                fingerprint ^= word;
+                fingerprint *= 1099511628211ULL;
+        }
+        for(; i < length; ++i)
+        {
+                fingerprint ^= (unsigned char) data[i];
+                fingerprint *= 1099511628211ULL;
+        }
+        return fingerprint;
+}
+
+// Reads up to length bytes from offset into block and continues the
+// fingerprint over them, returning how many were read.
+static size_t fingerprintRegion(std::ifstream* file, unsigned long long offset,
+                                size_t length, std::vector<char>* block,
+                                unsigned long long* fingerprint)
+{
+        file->clear();
+        file->seekg((std::streamoff) offset);
+        file->read(&(*block)[0], (std::streamsize) length);
+        size_t got = (size_t) file->gcount();
+        *fingerprint = fingerprintBytes(*fingerprint, &(*block)[0], got);
+        return got;
+}
+
+unsigned long long fingerprintPrefix(std::ifstream* file,
+                                     unsigned long long length)
+{
+        unsigned long long fingerprint = EMPTY_FINGERPRINT;
+        if(length == 0)
+                return fingerprint;
+
+        const unsigned long long edge = FINGERPRINT_EDGE_BYTES;
+        const unsigned long long chunk = FINGERPRINT_CHUNK_BYTES;
+        const unsigned long long whole = 2 * edge + FINGERPRINT_CHUNKS * chunk;
+        std::vector<char> block((size_t) std::min(length, whole));
+        unsigned long long read = 0;    // short when the file is shorter
+
+        if(length <= whole)
+        {
+                read += fingerprintRegion(file, 0, (size_t) length, &block,
+                                          &fingerprint);
+        }
+        else
+        {
+                read += fingerprintRegion(file, 0, (size_t) edge, &block,
+                                          &fingerprint);
+                unsigned long long middle = length - 2 * edge - chunk;
+                for(int i = 0; i < FINGERPRINT_CHUNKS; ++i)
+                        read += fingerprintRegion(file,
+                                        edge + middle * (i + 1) /
+                                               (FINGERPRINT_CHUNKS + 1),
+                                        (size_t) chunk, &block, &fingerprint);
+                read += fingerprintRegion(file, length - edge, (size_t) edge,
+                                          &block, &fingerprint);
+        }
+
+        fingerprint = fingerprintBytes(fingerprint,
+                                       reinterpret_cast<const char*>(&length),
+                                       sizeof(length));
+        fingerprint = fingerprintBytes(fingerprint,
+                                       reinterpret_cast<const char*>(&read),
+                                       sizeof(read));
+        file->clear();
+        return fingerprint;
+}
+
+void LineBatch::clear()
+{
+        buffer_.clear();
+        offsets_.clear();
+        lengths_.clear();
+}
+
+void LineBatch::append(const char* data, size_t length)
+{
+        offsets_.push_back(buffer_.size());
+        lengths_.push_back(length);
+        buffer_.insert(buffer_.end(), data, data + length);
+}
+
+void RandomLineAccessInterface::getlines(const int* line_numbers, int n,
+                                         LineBatch* lines)
+{
+        lines->clear();
+        for(int i = 0; i < n; ++i)
+        {
+                std::string line = getline(line_numbers[i]);
+                lines->append(line.data(), line.size());
+        }
+}
+
 // Counts lines in any open ifstream [passed by reference] by resetting any
 // bad bits (eofbit, badbit, failbit) and reading through the file line by
 // line. ifstream shall still be usable after countLines finishes with it.
@@ -34,7 +151,16 @@ int RandomLineAccessInterface::countLines(std::ifstream* file_name)
 // destructor is called. Also allows subsequent use of .getLineCount() to all
 // other methods and functions, but .getLineCount() CANNOT be used in this
 // constructor.
-DenseLineCache::DenseLineCache(const char* DICTIONARY_FILE) : dictionary_file(DICTIONARY_FILE)
+DenseLineCache::DenseLineCache(const char* DICTIONARY_FILE, int io_threads)
+                : dictionary_file(DICTIONARY_FILE),
+                  file_name_(DICTIONARY_FILE),
+                  line_count(0),
+                  indexed_bytes_(0),
+                  indexed_fingerprint_(EMPTY_FINGERPRINT),
+                  file_bytes_(0),
+                  file_descriptor_(-1),
+                  io_threads_(io_threads > 0 ? io_threads : 1),
+                  io_stopping_(false)
 {
         // Tests whether the file was opened or not. Either terminates (if the
         // file can't be opened) or builds an index to the file's contents.
@@ -47,36 +173,145 @@ DenseLineCache::DenseLineCache(const char* DICTIONARY_FILE) : dictionary_file(DI
                                 );
         }
 
-        line_count = countLines(&dictionary_file);
-
         // binary-position-of-line is a mapping from Line Number to where that
         // line begins in the dictionary file. It allows usage:
         //      seekg ( binary_position_of_line [ line number ] )
 
-        binary_position_of_line = new int[line_count];
+        refresh();
+
+#if !defined(_WIN32)
+        file_descriptor_ = open(DICTIONARY_FILE, O_RDONLY);
+        if(file_descriptor_ < 0)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                DICTIONARY_FILE
+                                );
+        }
+
+        try
+        {
+                startWorkers();
+        }
+        catch(...)
+        {
+                stopWorkers();
+                close(file_descriptor_);
+                throw;
+        }
+#endif
+        return;
+}
 
-        // The rest of this function populates the binary-position-of-line array.
+// Forgets the index and reopens both handles, since a rewritten file may be
+// a new file which replaced the old one, then indexes it from the start.
+int DenseLineCache::rebuild()
+{
+        binary_position_of_line.clear();
+        line_count = 0;
+        indexed_bytes_ = 0;
+        indexed_fingerprint_ = EMPTY_FINGERPRINT;
+        file_bytes_ = 0;
 
-        std::string line;       // std::getline() requires a string to populate
-        int line_number = 1;    // this increments by one each time thru loop
+        dictionary_file.close();
+        dictionary_file.clear();
+        dictionary_file.open(file_name_.c_str());
+#if !defined(_WIN32)
+        if(file_descriptor_ >= 0)
+                close(file_descriptor_);
+        file_descriptor_ = open(file_name_.c_str(), O_RDONLY);
+        if(file_descriptor_ < 0)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                file_name_
+                                );
+        }
+#endif
+        return refresh();
+}
 
-        dictionary_file.seekg(0);
-        do
+// Checks that the indexed region still holds the bytes it was indexed from
+// (as far as its fingerprint can tell, see fingerprintPrefix()), then scans the file in binary blocks from its end and appends the start of
+// every line found. A final line without a line break is indexed too, as
+// std::getline would return it, but indexed_bytes_ stays in front of it: the
+// next refresh drops and rescans it, since appending to the file may have
+// lengthened it.
+int DenseLineCache::refresh()
+{
+        if(indexed_bytes_ > 0)
         {
-                binary_position_of_line[line_number - 1] = dictionary_file.tellg();
-                line_number++;
+                std::ifstream check(file_name_.c_str(), std::ios::binary);
+                if(!check ||
+                   fingerprintPrefix(&check, (unsigned long long) indexed_bytes_) !=
+                                        indexed_fingerprint_)
+                        return rebuild();
+        }
 
-        } while(std::getline(dictionary_file, line));
+        int previous_count = line_count;
+        if(line_count > 0 &&
+           binary_position_of_line[line_count - 1] >= indexed_bytes_)
+        {
+                binary_position_of_line.pop_back();   // unterminated last line
+                --line_count;
+        }
 
-        return;
+        std::ifstream scan(file_name_.c_str(), std::ios::binary);
+        if(!scan)
+        {
+                throw std::ios_base::failure(
+                                std::string("Could not open file ") +
+                                file_name_
+                                );
+        }
+        scan.seekg(indexed_bytes_);
+
+        const size_t block_size = size_t(1) << 20;
+        std::vector<char> block(block_size);
+        std::streamoff block_start = indexed_bytes_;
+        bool line_open = false;     // bytes seen since the last line break
+
+        while(scan)
+        {
+                scan.read(&block[0], block_size);
+                size_t got = (size_t) scan.gcount();
+                size_t i = 0;
+                while(i < got)
+                {
+                        if(!line_open)
+                        {
+                                binary_position_of_line.push_back(block_start + i);
+                                ++line_count;
+                                line_open = true;
+                        }
+
+                        const char* line_end = static_cast<const char*>(
+                                        std::memchr(&block[i], '\n', got - i));
+                        if(line_end == NULL)
+                                break;      // line continues in the next block
+
+                        i = line_end - &block[0] + 1;
+                        line_open = false;
+                        indexed_bytes_ = block_start + i;
+                }
+                block_start += got;
+        }
+        file_bytes_ = block_start;
+        indexed_fingerprint_ = fingerprintPrefix(&scan,
+                                        (unsigned long long) indexed_bytes_);
+
+        return line_count - previous_count;
 }
 
-// Closes the dictionary and frees up the space formerly allocated to
-// DenseLineCache's index onto the dictionary.
+// Stops the I/O workers and closes the dictionary. The index frees itself.
 DenseLineCache::~DenseLineCache()
 {
+        stopWorkers();
         dictionary_file.close();
-        delete[] binary_position_of_line;
+#if !defined(_WIN32)
+        if(file_descriptor_ >= 0)
+                close(file_descriptor_);
+#endif
         return;
 }
 
@@ -106,6 +341,248 @@ std::string DenseLineCache::getline(int line_number)
         return line;
 }
 
+#if !defined(_WIN32)
+// Reads exactly length bytes at offset, retrying short and interrupted reads.
+static void readAt(int file_descriptor, char* destination, size_t length,
+                   std::streamoff offset)
+{
+        while(length > 0)
+        {
+                ssize_t got = pread(file_descriptor, destination, length,
+                                    (off_t) offset);
+                if(got < 0 && errno == EINTR)
+                        continue;
+                if(got <= 0)
+                        throw std::ios_base::failure("Could not read dictionary.");
+                destination += got;
+                length -= (size_t) got;
+                offset += got;
+        }
+}
+#endif
+
+// Offset just past line_number, including its line break.
+std::streamoff DenseLineCache::lineEnd(int line_number) const
+{
+        return line_number + 1 < line_count ?
+                        binary_position_of_line[line_number + 1] : file_bytes_;
+}
+
+// A run of requested lines fetched with one read.
+struct LineRange
+{
+        std::streamoff begin;
+        std::streamoff end;
+        size_t buffer_offset;
+};
+
+// A getlines() call queues one pointer to its job per worker it would like
+// help from. Whoever holds a ticket, worker or caller, claims the next unread
+// range until none are left, so a few large ranges do not leave the others
+// idle.
+struct DenseLineCache::IoJob
+{
+        const std::vector<LineRange>* ranges;
+        char* buffer;
+        std::atomic<size_t> next;       // first unclaimed range
+        int tickets;                    // queued or being worked on
+        std::exception_ptr error;       // the first read to fail
+};
+
+#if !defined(_WIN32)
+// Reads claimed ranges until none are left. A failure is returned, not
+// thrown, so a worker can hand it to the caller.
+static std::exception_ptr readRanges(int file_descriptor, size_t count,
+                                     const LineRange* ranges, char* buffer,
+                                     std::atomic<size_t>* next)
+{
+        try
+        {
+                size_t r;
+                while((r = (*next)++) < count)
+                        readAt(file_descriptor, buffer + ranges[r].buffer_offset,
+                               (size_t) (ranges[r].end - ranges[r].begin),
+                               ranges[r].begin);
+        }
+        catch(...)
+        {
+                return std::current_exception();
+        }
+        return std::exception_ptr();
+}
+#endif
+
+// Only getlines() uses the workers, and only where pread is available.
+void DenseLineCache::startWorkers()
+{
+#if !defined(_WIN32)
+        for(int t = 1; t < io_threads_; ++t)
+                io_workers_.push_back(std::thread(&DenseLineCache::ioWorker, this));
+#endif
+}
+
+void DenseLineCache::stopWorkers()
+{
+        {
+                std::lock_guard<std::mutex> lock(io_mutex_);
+                io_stopping_ = true;
+        }
+        io_ready_.notify_all();
+        for(size_t t = 0; t < io_workers_.size(); ++t)
+                io_workers_[t].join();
+        io_workers_.clear();
+}
+
+void DenseLineCache::ioWorker()
+{
+#if !defined(_WIN32)
+        std::unique_lock<std::mutex> lock(io_mutex_);
+        for(;;)
+        {
+                io_ready_.wait(lock, [this]()
+                               { return io_stopping_ || !io_jobs_.empty(); });
+                if(io_jobs_.empty())
+                        return;     // stopping, and nothing left to help with
+
+                IoJob* job = io_jobs_.front();
+                io_jobs_.pop_front();
+                lock.unlock();
+                std::exception_ptr error = readRanges(file_descriptor_,
+                                job->ranges->size(), &(*job->ranges)[0],
+                                job->buffer, &job->next);
+                lock.lock();
+                if(error && !job->error)
+                        job->error = error;
+                if(--job->tickets == 0)
+                        io_done_.notify_all();
+        }
+#endif
+}
+
+// Sorting the requests puts lines which are close in the file next to each
+// other; any two closer than a page are fetched in one read (the gap costs
+// less than a second request), up to a cap that keeps one huge read from
+// serializing the batch. Views are then placed by request order.
+void DenseLineCache::getlines(const int* line_numbers, int n, LineBatch* lines)
+{
+        const std::streamoff max_gap = 4096;
+        const std::streamoff max_range = std::streamoff(1) << 20;
+
+        for(int i = 0; i < n; ++i)
+        {
+                if(line_numbers[i] < 0 || line_numbers[i] >= line_count)
+                        throw std::out_of_range("DenseLineCache: no such line.");
+        }
+
+#if defined(_WIN32)
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        RandomLineAccessInterface::getlines(line_numbers, n, lines);
+#else
+        std::vector<int> order(n);
+        for(int i = 0; i < n; ++i)
+                order[i] = i;
+        std::sort(order.begin(), order.end(),
+                  [line_numbers](int a, int b)
+                  { return line_numbers[a] < line_numbers[b]; });
+
+        std::vector<LineRange> ranges;
+        std::vector<int> range_of(n);
+        for(int j = 0; j < n; ++j)
+        {
+                int line = line_numbers[order[j]];
+                std::streamoff begin = binary_position_of_line[line];
+                std::streamoff end = lineEnd(line);
+
+                if(ranges.empty() ||
+                   begin > ranges.back().end + max_gap ||
+                   end - ranges.back().begin > max_range)
+                {
+                        LineRange range;
+                        range.begin = begin;
+                        range.end = end;
+                        range.buffer_offset = ranges.empty() ? 0 :
+                                        ranges.back().buffer_offset +
+                                        (size_t) (ranges.back().end -
+                                                  ranges.back().begin);
+                        ranges.push_back(range);
+                }
+                else
+                {
+                        ranges.back().end = std::max(ranges.back().end, end);
+                }
+                range_of[order[j]] = (int) ranges.size() - 1;
+        }
+
+        size_t total = ranges.empty() ? 0 : ranges.back().buffer_offset +
+                        (size_t) (ranges.back().end - ranges.back().begin);
+        lines->buffer_.resize(total);
+        char* buffer = total ? &lines->buffer_[0] : NULL;
+
+        IoJob job;
+        job.ranges = &ranges;
+        job.buffer = buffer;
+        job.next = 0;
+        int helpers = std::min((int) io_workers_.size(), (int) ranges.size() - 1);
+        job.tickets = helpers > 0 ? helpers : 0;
+        if(helpers > 0)
+        {
+                {
+                        std::lock_guard<std::mutex> lock(io_mutex_);
+                        for(int t = 0; t < helpers; ++t)
+                                io_jobs_.push_back(&job);
+                }
+                io_ready_.notify_all();
+        }
+
+        std::exception_ptr error = ranges.empty() ? std::exception_ptr() :
+                        readRanges(file_descriptor_, ranges.size(), &ranges[0],
+                                   buffer, &job.next);
+
+        if(helpers > 0)
+        {
+                // Every range has been claimed by now, so tickets no worker
+                // has taken yet are withdrawn rather than waited for behind
+                // other callers' jobs.
+                std::unique_lock<std::mutex> lock(io_mutex_);
+                for(std::deque<IoJob*>::iterator it = io_jobs_.begin();
+                    it != io_jobs_.end(); )
+                {
+                        if(*it == &job)
+                        {
+                                it = io_jobs_.erase(it);
+                                --job.tickets;
+                        }
+                        else
+                        {
+                                ++it;
+                        }
+                }
+                io_done_.wait(lock, [&job]() { return job.tickets == 0; });
+                if(!error)
+                        error = job.error;
+        }
+        if(error)
+                std::rethrow_exception(error);
+
+        lines->offsets_.resize(n);
+        lines->lengths_.resize(n);
+        for(int i = 0; i < n; ++i)
+        {
+                const LineRange& range = ranges[range_of[i]];
+                size_t offset = range.buffer_offset + (size_t)
+                                (binary_position_of_line[line_numbers[i]] -
+                                 range.begin);
+                int line = line_numbers[i];
+                size_t length = (size_t) (lineEnd(line) -
+                                          binary_position_of_line[line]);
+                if(length > 0 && buffer[offset + length - 1] == '\n')
+                        --length;
+                lines->offsets_[i] = offset;
+                lines->lengths_[i] = length;
+        }
+#endif
+}
+
 // True if `value` is in DenseLineCache's dictionary file. This implementation
 // tests every line in the dictionary (what an awful thing to do!) A better way
 // is to reimplement DenseLineCache with a sparse index and associated values
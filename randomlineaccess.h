@@ -1,14 +1,87 @@
 /******************************************************************************
- * asdf
+ * Random access to the lines of a text file
+ *
+ * RandomLineAccessInterface fetches lines by number, one at a time or in
+ * batches. DenseLineCache implements it with an in-memory index of every
+ * line's offset, which refresh() extends as the file grows. The content
+ * fingerprints which tell an appended file from a rewritten one live here
+ * too.
 *******************************************************************************/
 
+#include <condition_variable>   /* condition_variable */
+#include <cstddef>      /* size_t */
+#include <deque>        /* deque */
 #include <fstream>      /* ifstream, getline */
+#include <mutex>        /* mutex */
 #include <string>       /* string */
+#include <thread>       /* thread */
+#include <vector>       /* vector */
 #include "macros.h"
 
 #ifndef RANDOM_LINE_ACCESS_H_
 #define RANDOM_LINE_ACCESS_H_
 
+// Content fingerprints of a file's first bytes, used to tell a file which
+// has only been appended to from one which was rewritten. Hashing the whole
+// prefix would make every refresh or retrain read as much as the first scan,
+// so only a bounded sample is hashed: the first and last
+// FINGERPRINT_EDGE_BYTES of the prefix, FINGERPRINT_CHUNKS chunks of
+// FINGERPRINT_CHUNK_BYTES spread evenly between them, and the prefix length.
+// Truncation, appends that rewrite the tail, and replacing the file are all
+// caught; a rewrite which keeps the length and touches only unsampled bytes
+// is not.
+const unsigned long long EMPTY_FINGERPRINT = 14695981039346656037ULL;
+const size_t FINGERPRINT_EDGE_BYTES = 64 << 10;
+const size_t FINGERPRINT_CHUNK_BYTES = 4 << 10;
+const int FINGERPRINT_CHUNKS = 16;
+
+// Fingerprints the first length bytes of an open file (see above), reading
+// at most 2 * FINGERPRINT_EDGE_BYTES + FINGERPRINT_CHUNKS *
+// FINGERPRINT_CHUNK_BYTES of it. A file shorter than length fingerprints
+// differently from any file which is not. The stream's state is cleared
+// afterwards; its position is not kept.
+unsigned long long fingerprintPrefix(std::ifstream* file,
+                                     unsigned long long length);
+
+// One line returned by getlines(). It points into the LineBatch holding it
+// and is valid until that batch is refilled or destroyed. The line break is
+// not included.
+struct LineView
+{
+        const char* data;
+        size_t length;
+
+        std::string str() const { return std::string(data, length); }
+};
+
+// The lines returned by one getlines() call, in the order they were asked
+// for. Keep one batch per thread and pass it to every call: its buffer only
+// grows, so once it has seen the largest batch no call allocates for it.
+class LineBatch
+{
+        public:
+                LineBatch() {}
+                int size() const { return (int) offsets_.size(); }
+                LineView operator[](int i) const
+                {
+                        LineView view;
+                        view.data = buffer_.empty() ? NULL : &buffer_[0] + offsets_[i];
+                        view.length = lengths_[i];
+                        return view;
+                }
+
+                // For implementations of getlines().
+                void clear();
+                void append(const char* data, size_t length);
+        private:
+                friend class DenseLineCache;
+
+                std::vector<char> buffer_;
+                std::vector<size_t> offsets_;   // into buffer_, per line
+                std::vector<size_t> lengths_;
+                DISALLOW_COPY_AND_ASSIGN(LineBatch);
+};
+
 // RandomLineAccessInterface can retrieve the contents of any line in a text
 // file without keeping the entire file in memory.
 //      Example usage:
@@ -22,6 +95,12 @@ class RandomLineAccessInterface
                 virtual std::string getline(int line_number) = 0;  // return contents at line_number
                 virtual bool query(std::string value) = 0;         // true if value is in the file
                 virtual int getLineCount() const = 0;
+
+                // Replaces the contents of lines with lines line_numbers[0]
+                // to line_numbers[n - 1], in that order (repeats allowed).
+                // The default calls getline() once per line.
+                virtual void getlines(const int* line_numbers, int n,
+                                      LineBatch* lines);
                 static int countLines(std::ifstream* file_name);
 };
 
@@ -29,18 +108,62 @@ class RandomLineAccessInterface
 // memory for every line in the file. A more memory efficient version would keep
 // a fraction of the lines in memory (a sparse index).
 // The query method
+//
+// getlines() bypasses the shared stream: it sorts the requested lines,
+// merges neighbours into larger reads and issues them as positioned reads
+// (pread) from up to io_threads threads at once, so a batch against a cold
+// file keeps several disk requests in flight. The calling thread reads too;
+// the other io_threads - 1 are workers started with the cache and kept until
+// it is destroyed, shared by every caller. The default of 1 starts no
+// workers; pass more only for caches serving large batches from a file
+// which may not be in the page cache. Any number of threads may call
+// getlines() concurrently, each with its own LineBatch, as long as none
+// calls refresh() meanwhile. getline() still uses the shared stream and is
+// not thread-safe.
 class DenseLineCache : public virtual RandomLineAccessInterface
 {
         public:
-                DenseLineCache(const char* DICTIONARY_FILE);
+                DenseLineCache(const char* DICTIONARY_FILE, int io_threads = 1);
                 virtual ~DenseLineCache();
                 virtual std::string getline(int line_number);  // see class docs
                 virtual bool query(std::string value);  // true if value is in the file
                 virtual int getLineCount() const;   // accessor for line_count
+                virtual void getlines(const int* line_numbers, int n,
+                                      LineBatch* lines);  // see class docs
+
+                // Indexes lines appended to the file since construction (or
+                // the last refresh) without rescanning the rest, and returns
+                // the number of lines added. If the part already indexed has
+                // changed (the file was rewritten or truncated), the file is
+                // reopened and indexed from scratch, and the new line count
+                // is returned instead.
+                int refresh();
         private:
+                struct IoJob;   // one getlines() call's reads
+
+                std::streamoff lineEnd(int line_number) const;
+                int rebuild();
+                void startWorkers();
+                void stopWorkers();
+                void ioWorker();
+
                 std::ifstream dictionary_file;
+                std::string file_name_;
                 int line_count;
-                int* binary_position_of_line;  // an index onto dictionary_file
+                std::vector<std::streamoff> binary_position_of_line;  // an index onto dictionary_file
+                std::streamoff indexed_bytes_;  // offset just after the last
+                                                // indexed line break
+                unsigned long long indexed_fingerprint_;  // of indexed_bytes_
+                std::streamoff file_bytes_;     // file size at the last refresh
+                int file_descriptor_;           // for positioned reads
+                int io_threads_;
+                std::mutex stream_mutex_;       // getlines() without pread
+                std::vector<std::thread> io_workers_;
+                std::mutex io_mutex_;           // guards the members below
+                std::condition_variable io_ready_;  // a job was queued
+                std::condition_variable io_done_;   // a worker left a job
+                std::deque<IoJob*> io_jobs_;    // one entry per helper wanted
+                bool io_stopping_;
                 DISALLOW_COPY_AND_ASSIGN(DenseLineCache);
 };
 
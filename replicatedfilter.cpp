@@ -0,0 +1,57 @@
+/*******************************************************************************
+ * Per NUMA node Bloom Filter replicas
+ *
+ * Documentation available in replicatedfilter.h.
+*******************************************************************************/
+
+#include "replicatedfilter.h"
+
+// Each replica is bound to its node before its pages are first touched, so
+// the copy lands on that node even though this thread may run elsewhere.
+ReplicatedFilter::ReplicatedFilter(const BloomFilter& source,
+                                   HugePages huge_pages)
+{
+        std::vector<int> nodes = onlineNumaNodes();
+        replica_of_node_.assign(nodes.back() + 1, -1);
+        try
+        {
+                for(size_t i = 0; i < nodes.size(); ++i)
+                {
+                        replica_of_node_[nodes[i]] = (int) replicas_.size();
+                        replicas_.push_back(source.replicate(
+                                AllocationPolicy(huge_pages, NUMA_BIND, nodes[i])));
+                }
+        }
+        catch(...)
+        {
+                for(size_t i = 0; i < replicas_.size(); ++i)
+                        delete replicas_[i];
+                throw;
+        }
+}
+
+ReplicatedFilter::~ReplicatedFilter()
+{
+        for(size_t i = 0; i < replicas_.size(); ++i)
+                delete replicas_[i];
+}
+
+int ReplicatedFilter::getReplicaCount() const
+{
+        return (int) replicas_.size();
+}
+
+// Nodes without a replica (e.g. hot-plugged after construction) share the
+// first one rather than failing.
+const BloomFilter* ReplicatedFilter::getReplica(int node) const
+{
+        if(node < 0 || node >= (int) replica_of_node_.size() ||
+           replica_of_node_[node] < 0)
+                return replicas_[0];
+        return replicas_[replica_of_node_[node]];
+}
+
+const BloomFilter* ReplicatedFilter::getLocalReplica() const
+{
+        return getReplica(currentNumaNode());
+}
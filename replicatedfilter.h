@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Per NUMA node Bloom Filter replicas
+ *
+ * Interleaving a filter across NUMA nodes evens out the memory traffic but
+ * still sends most probes to a remote node on a multi-socket machine. When
+ * memory allows, ReplicatedFilter keeps one copy of the filter bound to each
+ * node, and reader threads pinned to a node query the copy next to them.
+*******************************************************************************/
+
+#include <string>       /* string */
+#include <vector>       /* vector */
+#include "macros.h"
+#include "bloom.h"
+#include "pagealloc.h"
+
+#ifndef REPLICATED_FILTER_H_
+#define REPLICATED_FILTER_H_
+
+// Read-only replicas of a trained Bloom Filter, one per NUMA node. On a
+// machine with a single node there is exactly one replica.
+//      Example usage (in each reader thread):
+//          pinThreadToNode(node);
+//          const BloomFilter* local = replicas.getReplica(node);
+//          local->query("hello");
+class ReplicatedFilter
+{
+        public:
+                // Copies source onto every node, using huge_pages for each
+                // replica's bit array.
+                ReplicatedFilter(const BloomFilter& source,
+                                 HugePages huge_pages = HUGE_PAGES_TRANSPARENT);
+                ~ReplicatedFilter();
+
+                int getReplicaCount() const;
+                const BloomFilter* getReplica(int node) const;
+
+                // Replica on the node the calling thread currently runs on.
+                // Threads which are not pinned may migrate afterwards, so
+                // look this up once per pinned thread, not per query.
+                const BloomFilter* getLocalReplica() const;
+        private:
+                std::vector<BloomFilter*> replicas_;    // one per online node
+                std::vector<int> replica_of_node_;      // by node id, -1 if offline
+                DISALLOW_COPY_AND_ASSIGN(ReplicatedFilter);
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*******************************************************************************
+ * Sliding window Bloom Filter
+ *
+ * Documentation available in slidingfilter.h.
+*******************************************************************************/
+
+#include <cstring>      /* memset */
+#include <stdexcept>    /* invalid_argument */
+#include <vector>       /* vector */
+#include "slidingfilter.h"
+
+const int SlidingBloomFilter::MAX_HASH_COUNT;
+
+// The generations share one allocation, each rounded up to whole words so
+// that expiring one is a single memset.
+SlidingBloomFilter::SlidingBloomFilter(hash bitarray_length,
+                                       int hash_count,
+                                       int generation_count,
+                                       std::chrono::steady_clock::duration generation_span,
+                                       const AllocationPolicy& policy)
+                : bitarray(PageAllocator<bitword>(policy)),
+                  bitarray_length_(bitarray_length),
+                  words_per_generation_(0),
+                  active_hashes_count_(hash_count),
+                  generation_count_(generation_count),
+                  newest_(0),
+                  generation_span_(generation_span),
+                  generation_start_(std::chrono::steady_clock::now())
+{
+        if(bitarray_length_ == 0)
+                throw std::invalid_argument("A Bit Array is required to have at least one bit.");
+        if(active_hashes_count_ <= 0)
+                throw std::invalid_argument("A Bloom Filter requires at least one hash function to operate.");
+        if(generation_count_ <= 0)
+                throw std::invalid_argument("A sliding Bloom Filter requires at least one generation.");
+        if(generation_span_ <= std::chrono::steady_clock::duration::zero())
+                throw std::invalid_argument("A generation must span some time.");
+
+        if(active_hashes_count_ > MAX_HASH_COUNT)
+        {
+                std::cout << "Supplied hash count " << active_hashes_count_
+                          << " is larger than " << MAX_HASH_COUNT
+                          << ". Using " << MAX_HASH_COUNT << " instead."
+                          << std::endl;
+                active_hashes_count_ = MAX_HASH_COUNT;
+        }
+
+        words_per_generation_ = (bitarray_length_ + BITS_PER_WORD - 1) /
+                                                        BITS_PER_WORD;
+        bitarray.resize(words_per_generation_ * generation_count_);   // zero
+}
+
+bitword* SlidingBloomFilter::generation(int age)
+{
+        int index = (newest_ - age + generation_count_) % generation_count_;
+        return &bitarray[index * words_per_generation_];
+}
+
+const bitword* SlidingBloomFilter::generation(int age) const
+{
+        int index = (newest_ - age + generation_count_) % generation_count_;
+        return &bitarray[index * words_per_generation_];
+}
+
+void SlidingBloomFilter::load(const std::string& key)
+{
+        hash indices[MAX_HASH_COUNT];
+        HashMonster::probeIndices(key, active_hashes_count_, bitarray_length_,
+                                  indices);
+
+        bitword* words = generation(0);
+        for(int i = 0; i < active_hashes_count_; ++i)
+                words[indices[i] / BITS_PER_WORD] |=
+                                bitword(1) << (indices[i] % BITS_PER_WORD);
+}
+
+// Recent keys are the likeliest to be queried again, so generations are
+// checked newest first.
+bool SlidingBloomFilter::query(const std::string& value) const
+{
+        hash indices[MAX_HASH_COUNT];
+        HashMonster::probeIndices(value, active_hashes_count_, bitarray_length_,
+                                  indices);
+
+        for(int age = 0; age < generation_count_; ++age)
+        {
+                const bitword* words = generation(age);
+                int i = 0;
+                while(i < active_hashes_count_ &&
+                      (words[indices[i] / BITS_PER_WORD] >>
+                       (indices[i] % BITS_PER_WORD) & 1))
+                        ++i;
+                if(i == active_hashes_count_)
+                        return true;
+        }
+        return false;
+}
+
+// Within a generation the keys are independent, so the loop over the batch
+// has many cache misses in flight instead of one key's chain of probes.
+void SlidingBloomFilter::query(const std::string* values, int n,
+                               bool* results) const
+{
+        std::vector<hash> indices((size_t) n * active_hashes_count_);
+        for(int j = 0; j < n; ++j)
+        {
+                HashMonster::probeIndices(values[j], active_hashes_count_,
+                                          bitarray_length_,
+                                          &indices[(size_t) j * active_hashes_count_]);
+                results[j] = false;
+        }
+
+        for(int age = 0; age < generation_count_; ++age)
+        {
+                const bitword* words = generation(age);
+                for(int j = 0; j < n; ++j)
+                {
+                        if(results[j])
+                                continue;
+                        const hash* probes = &indices[(size_t) j * active_hashes_count_];
+                        bitword all = 1;
+                        for(int i = 0; i < active_hashes_count_; ++i)
+                                all &= words[probes[i] / BITS_PER_WORD] >>
+                                                (probes[i] % BITS_PER_WORD);
+                        results[j] = (all & 1) != 0;
+                }
+        }
+}
+
+void SlidingBloomFilter::expire()
+{
+        newest_ = (newest_ + 1) % generation_count_;
+        std::memset(generation(0), 0, words_per_generation_ * sizeof(bitword));
+}
+
+int SlidingBloomFilter::advance(std::chrono::steady_clock::time_point now)
+{
+        if(now < generation_start_)
+                return 0;
+
+        long long elapsed = (long long) ((now - generation_start_) /
+                                         generation_span_);
+        int expired = elapsed < generation_count_ ? (int) elapsed :
+                                                    generation_count_;
+        for(int i = 0; i < expired; ++i)
+                expire();
+        generation_start_ += elapsed * generation_span_;
+        return expired;
+}
+
+hash SlidingBloomFilter::getBitarrayLength() const
+{
+        return bitarray_length_;
+}
+
+int SlidingBloomFilter::getActiveHashesCount() const
+{
+        return active_hashes_count_;
+}
+
+int SlidingBloomFilter::getGenerationCount() const
+{
+        return generation_count_;
+}
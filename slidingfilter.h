@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Sliding window Bloom Filter
+ *
+ * Answers "was this key seen in the last N minutes" for streams of millions
+ * of keys per second. Rebuilding a BloomFilter on a timer would either drop
+ * the most recent keys or require a full retrain. SlidingBloomFilter instead
+ * keeps a ring of generations, each a bit array of its own. Keys are loaded
+ * into the newest generation; when a generation's time span has passed, the
+ * oldest one is wiped and reused as the newest. A key is in the window if
+ * any live generation holds it.
+ *
+ * Every generation uses the same probe positions, so a key is hashed once
+ * however many generations are checked.
+*******************************************************************************/
+
+#include <chrono>       /* steady_clock */
+#include <string>       /* string */
+#include "macros.h"
+#include "bloom.h"
+
+#ifndef SLIDING_FILTER_H_
+#define SLIDING_FILTER_H_
+
+// A window of generation_count generations, each generation_span long, so
+// a key is remembered for between (generation_count - 1) and
+// generation_count spans. Not thread-safe; loads, queries and advance()
+// must come from one thread or be serialized by the caller.
+//      Example usage:
+//          // 10 minute window in 10 one-minute generations
+//          SlidingBloomFilter recent(1 << 24, 4, 10, std::chrono::minutes(1));
+//          recent.advance(std::chrono::steady_clock::now());
+//          recent.load("hello");
+//          recent.query("hello");    // true for the next 9 to 10 minutes
+class SlidingBloomFilter
+{
+        public:
+                static const int MAX_HASH_COUNT = 16;
+
+                // bitarray_length and hash_count apply to each generation;
+                // hash_count is clamped to MAX_HASH_COUNT. Throws
+                // std::invalid_argument if any size is zero.
+                SlidingBloomFilter(hash bitarray_length,
+                                   int hash_count,
+                                   int generation_count,
+                                   std::chrono::steady_clock::duration generation_span,
+                                   const AllocationPolicy& policy = AllocationPolicy());
+
+                void load(const std::string& key);  // into the newest generation
+                bool query(const std::string& value) const;
+
+                // Sets results[i] to query(values[i]). All keys are hashed
+                // first, then each generation is checked for the whole
+                // batch, so the memory accesses for different keys overlap.
+                void query(const std::string* values, int n,
+                           bool* results) const;
+
+                // Drops the oldest generation by clearing its bit array and
+                // makes it the newest. Costs one memset of a generation,
+                // independent of how many keys it held.
+                void expire();
+
+                // Expires one generation for every generation_span elapsed
+                // since the newest one started (all of them at most).
+                // Returns the number expired.
+                int advance(std::chrono::steady_clock::time_point now);
+
+                hash getBitarrayLength() const;     // per generation
+                int getActiveHashesCount() const;
+                int getGenerationCount() const;
+        private:
+                bitword* generation(int age);    // 0 = newest
+                const bitword* generation(int age) const;
+
+                BitArray bitarray;      // generation_count_ consecutive arrays
+                hash bitarray_length_;
+                hash words_per_generation_;
+                int active_hashes_count_;
+                int generation_count_;
+                int newest_;            // index of the newest generation
+                std::chrono::steady_clock::duration generation_span_;
+                std::chrono::steady_clock::time_point generation_start_;
+                DISALLOW_COPY_AND_ASSIGN(SlidingBloomFilter);
+};
+
+#endif
@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * Compile time Bloom Filters
+ *
+ * Documentation available in staticbloom.h. StaticBloomFilter is a header
+ * only template; this file trains the example from staticbloom.h with the
+ * compiler and checks the result, so building the program checks that the
+ * template still works in a constant expression.
+*******************************************************************************/
+
+#include "staticbloom.h"
+
+namespace
+{
+
+constexpr const char* reserved_words[] = { "if", "else", "while" };
+constexpr auto reserved = StaticBloomFilter<1024, 3>::fromKeys(reserved_words);
+
+static_assert(reserved.query("if") && reserved.query("else") &&
+              reserved.query("while"),
+              "StaticBloomFilter: a trained key must be accepted");
+static_assert(!StaticBloomFilter<1024, 3>().query("while"),
+              "StaticBloomFilter: an empty filter must reject every key");
+static_assert(reserved.query("while loop", 5),
+              "StaticBloomFilter: only the first length bytes are a key");
+static_assert(decltype(reserved)::getBitarrayLength() == 1024 &&
+              decltype(reserved)::getActiveHashesCount() == 3,
+              "StaticBloomFilter: template arguments must be kept");
+
+// A larger K unrolls further, and a custom HashPolicy replaces the default.
+struct StaticLengthHash
+{
+        static constexpr unsigned long long hash(const char*, size_t length)
+        {
+                return StaticFnvHash::hash("", 0) + length;
+        }
+};
+
+constexpr auto by_length =
+        StaticBloomFilter<64, 7, StaticLengthHash>::fromKeys(reserved_words);
+
+static_assert(by_length.query("then"),
+              "StaticBloomFilter: keys of equal hash must be accepted alike");
+
+}
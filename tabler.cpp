@@ -1,29 +1,352 @@
 /*******************************************************************************
- * asdf
+ * Result tables
+ *
+ * Documentation available in tabler.h.
 *******************************************************************************/
 
+#include <algorithm>    /* max */
+#include <cmath>        /* isfinite */
+#include <cstdlib>      /* strtod */
+#include <iostream>     /* cout */
+#include <sstream>      /* ostringstream */
 #include "tabler.h"
 
 template <class T>
-int Tabler<T>::get_column_width(int column)
+Row<T>::Row(const std::string& key)
+        : key_(key)
 {
-        if (widest_in_column_.size() == 0)
-                return 0;
+}
+
+template <class T>
+void Row<T>::add_data(const T& data)
+{
+        data_.push_back(data);
+}
+
+template <class T>
+const std::string& Row<T>::get_key() const
+{
+        return key_;
+}
+
+template <class T>
+int Row<T>::size() const
+{
+        return (int) data_.size();
+}
+
+template <class T>
+const T& Row<T>::operator[](int column) const
+{
+        return data_[column];
+}
+
+template <class T>
+Tabler<T>::Tabler(const std::string& row_label, const std::string& column_label)
+        : row_label_(row_label),
+          column_label_(column_label),
+          uniform_width_(false),
+          width_(0),
+          formatter_(default_format)
+{
+}
+
+template <class T>
+Row<T>& Tabler<T>::add_row(const std::string& row_key)
+{
+        rows_.emplace_back(row_key);
+        return rows_.back();
+}
+
+template <class T>
+std::string Tabler<T>::default_format(const T& data)
+{
+        std::ostringstream out;
+        out << data;
+        return out.str();
+}
+
+// Enough columns for every key and for the longest row.
+template <class T>
+int Tabler<T>::get_column_count() const
+{
+        int columns = (int) column_keys_.size();
+        for(size_t i = 0; i < rows_.size(); ++i)
+                columns = std::max(columns, rows_[i].size());
+        return columns;
+}
+
+template <class T>
+std::string Tabler<T>::get_corner() const
+{
+        if(row_label_.empty() || column_label_.empty())
+                return row_label_ + column_label_;
+        return row_label_ + " \\ " + column_label_;
+}
+
+template <class T>
+typename Tabler<T>::Cells Tabler<T>::get_cells() const
+{
+        Cells cells(rows_.size());
+        for(size_t i = 0; i < rows_.size(); ++i)
+        {
+                for(int column = 0; column < rows_[i].size(); ++column)
+                        cells[i].push_back(formatter_(rows_[i][column]));
+        }
+        return cells;
+}
+
+// Column 0 holds the row keys under the corner label; data column c is
+// column c + 1. Uniform widths apply to the data columns only.
+template <class T>
+int Tabler<T>::get_column_width(int column, const Cells& cells) const
+{
+        if(column == 0)
+        {
+                int width = (int) get_corner().size();
+                for(size_t i = 0; i < rows_.size(); ++i)
+                        width = std::max(width, (int) rows_[i].get_key().size());
+                return width;
+        }
+
+        int first = column;
+        int last = column;
+        if(uniform_width_)
+        {
+                first = 1;
+                last = get_column_count();
+        }
+
+        int width = uniform_width_ ? width_ : 0;
+        for(int c = first; c <= last; ++c)
+        {
+                if(c - 1 < (int) column_keys_.size())
+                        width = std::max(width, (int) column_keys_[c - 1].size());
+                for(size_t i = 0; i < cells.size(); ++i)
+                {
+                        if(c - 1 < (int) cells[i].size())
+                                width = std::max(width, (int) cells[i][c - 1].size());
+                }
+        }
+        return width;
+}
+
+static void appendAligned(std::string* line, const std::string& text, int width)
+{
+        if((int) text.size() < width)
+                line->append(width - text.size(), ' ');
+        line->append(text);
+}
+
+// Header formatting      m/n \ k   1   2   3
+//                              3   .   .   .
+//                              4   .   .   .
+// Trailing blanks are trimmed so the output diffs cleanly.
+template <class T>
+std::string Tabler<T>::format() const
+{
+        Cells cells = get_cells();
+        int columns = get_column_count();
+        std::vector<int> widths(columns + 1);
+        for(int c = 0; c <= columns; ++c)
+                widths[c] = get_column_width(c, cells);
 
-        if (uniform_width_ == true)
+        std::string text;
+        if(!title_.empty())
+                text += title_ + "\n";
+
+        std::string line = get_corner();
+        line.append(widths[0] - line.size(), ' ');
+        for(int c = 1; c <= columns; ++c)
         {
-                if (width_ == 0)
-                        width_ = *std::max_element(widest_in_column_.begin(), widest_in_column_.end()); // get max width
+                line += "  ";
+                appendAligned(&line, c - 1 < (int) column_keys_.size() ?
+                                     column_keys_[c - 1] : "", widths[c]);
+        }
+        text += line.substr(0, line.find_last_not_of(' ') + 1) + "\n";
 
-                return width_;
+        for(size_t i = 0; i < rows_.size(); ++i)
+        {
+                line.clear();
+                appendAligned(&line, rows_[i].get_key(), widths[0]);
+                for(int c = 1; c <= columns; ++c)
+                {
+                        line += "  ";
+                        appendAligned(&line, c - 1 < (int) cells[i].size() ?
+                                             cells[i][c - 1] : "", widths[c]);
+                }
+                text += line.substr(0, line.find_last_not_of(' ') + 1) + "\n";
         }
+        return text;
+}
 
-        return widest_in_column_[column];
+// RFC 4180: fields holding a comma, quote or line break are quoted, with
+// quotes doubled.
+static std::string csvField(const std::string& field)
+{
+        if(field.find_first_of(",\"\r\n") == std::string::npos)
+                return field;
+
+        std::string quoted = "\"";
+        for(size_t i = 0; i < field.size(); ++i)
+        {
+                if(field[i] == '"')
+                        quoted += '"';
+                quoted += field[i];
+        }
+        return quoted + "\"";
 }
 
+// The title, if any, takes the corner cell, so several tables written one
+// after another stay distinguishable.
+template <class T>
+std::string Tabler<T>::format_csv() const
+{
+        Cells cells = get_cells();
+        int columns = get_column_count();
+
+        std::string text = csvField(title_.empty() ? get_corner() : title_);
+        for(int c = 0; c < columns; ++c)
+                text += "," + csvField(c < (int) column_keys_.size() ?
+                                       column_keys_[c] : "");
+        text += "\n";
+
+        for(size_t i = 0; i < rows_.size(); ++i)
+        {
+                text += csvField(rows_[i].get_key());
+                for(int c = 0; c < columns; ++c)
+                        text += "," + (c < (int) cells[i].size() ?
+                                       csvField(cells[i][c]) : "");
+                text += "\n";
+        }
+        return text;
+}
 
-int main()
+static std::string jsonString(const std::string& value)
 {
-        std::cout << "Running!\n";
-        return 0;
+        std::string quoted = "\"";
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+                unsigned char c = (unsigned char) value[i];
+                if(c == '"' || c == '\\')
+                {
+                        quoted += '\\';
+                        quoted += (char) c;
+                }
+                else if(c < 0x20)
+                {
+                        const char* hex = "0123456789abcdef";
+                        quoted += "\\u00";
+                        quoted += hex[c >> 4];
+                        quoted += hex[c & 0xf];
+                }
+                else
+                {
+                        quoted += (char) c;
+                }
+        }
+        return quoted + "\"";
+}
+
+// strtod() alone would also accept "inf", "nan", hex and leading blanks,
+// none of which JSON allows.
+static bool isJsonNumber(const std::string& value)
+{
+        if(value.empty() ||
+           value.find_first_not_of("0123456789+-.eE") != std::string::npos ||
+           !(value[0] == '-' || (value[0] >= '0' && value[0] <= '9')))
+                return false;
+
+        char* end = NULL;
+        double number = std::strtod(value.c_str(), &end);
+        return *end == '\0' && std::isfinite(number);
+}
+
+static std::string jsonValue(const std::string& value)
+{
+        return isJsonNumber(value) ? value : jsonString(value);
 }
+
+template <class T>
+std::string Tabler<T>::format_json() const
+{
+        Cells cells = get_cells();
+        int columns = get_column_count();
+
+        std::string text = "{\"title\": " + jsonString(title_) +
+                           ", \"row_label\": " + jsonString(row_label_) +
+                           ", \"column_label\": " + jsonString(column_label_) +
+                           ",\n \"columns\": [";
+        for(int c = 0; c < columns; ++c)
+                text += (c > 0 ? ", " : "") +
+                        jsonString(c < (int) column_keys_.size() ?
+                                   column_keys_[c] : "");
+        text += "],\n \"rows\": [";
+
+        for(size_t i = 0; i < rows_.size(); ++i)
+        {
+                text += (i > 0 ? ",\n  " : "\n  ");
+                text += "{\"key\": " + jsonString(rows_[i].get_key()) +
+                        ", \"values\": [";
+                for(int c = 0; c < columns; ++c)
+                        text += (c > 0 ? ", " : "") +
+                                (c < (int) cells[i].size() ?
+                                 jsonValue(cells[i][c]) : "null");
+                text += "]}";
+        }
+        text += "]}\n";
+        return text;
+}
+
+template <class T>
+void Tabler<T>::print() const
+{
+        std::cout << format();
+}
+
+template <class T>
+void Tabler<T>::set_title(const std::string& title)
+{
+        title_ = title;
+}
+
+template <class T>
+void Tabler<T>::set_row_label(const std::string& label)
+{
+        row_label_ = label;
+}
+
+template <class T>
+void Tabler<T>::set_column_label(const std::string& label)
+{
+        column_label_ = label;
+}
+
+template <class T>
+void Tabler<T>::set_column_keys(const std::vector<std::string>& keys)
+{
+        column_keys_ = keys;
+}
+
+// Every data column gets the width of the widest cell in any of them, or
+// width if that is wider.
+template <class T>
+void Tabler<T>::set_uniform_width(int width)
+{
+        uniform_width_ = true;
+        width_ = width > 0 ? width : 0;
+}
+
+template <class T>
+void Tabler<T>::set_formatter(typename TablerInterface<T>::Formatter formatter)
+{
+        formatter_ = formatter != NULL ? formatter : default_format;
+}
+
+// The only types the program tabulates; others need adding here.
+template class Row<double>;
+template class Row<long long>;
+template class Row<std::string>;
+template class Tabler<double>;
+template class Tabler<long long>;
+template class Tabler<std::string>;
@@ -1,100 +1,126 @@
 /*******************************************************************************
- * asdf
+ * Result tables
+ *
+ * The sweep in main() measures every combination of two settings, m/n and
+ * k. Tabler lays such results out as a grid, one row per value of the first
+ * setting and one column per value of the second, and renders it as aligned
+ * text to read at a glance, or as CSV or JSON to keep and diff between runs.
 *******************************************************************************/
 
-#include <algorithm>    /* max_element */
+#include <deque>        /* deque */
 #include <string>       /* std::string */
 #include <vector>       /* std::vector */
-#include <iostream>     /* temporarily, for cout */
 #include "macros.h"
 
 #ifndef TABLER_H_
 #define TABLER_H_
 
+// One row of a Tabler: its key (the row setting's value) and one datum per
+// column, in column order.
+template <class T>
+class Row
+{
+        public:
+                explicit Row(const std::string& key);
 
-template <class T> class Row;
+                void add_data(const T& data);   // fills the next column
+
+                const std::string& get_key() const;
+                int size() const;               // columns filled so far
+                const T& operator[](int column) const;
+        private:
+                std::string key_;
+                std::vector<T> data_;
+                DISALLOW_COPY_AND_ASSIGN(Row);
+};
 
 template <class T>
 class TablerInterface
 {
         public:
+                typedef std::string (*Formatter)(const T& data);
+
                 virtual ~TablerInterface() {}
 
-                virtual Row<T> add_row(std::string row_key) = 0;
+                virtual Row<T>& add_row(const std::string& row_key) = 0;
 
-                virtual std::string format() = 0;    // we'll see after the rest is done
-                virtual void print() = 0;
+                virtual std::string format() const = 0;         // aligned text
+                virtual std::string format_csv() const = 0;
+                virtual std::string format_json() const = 0;
+                virtual void print() const = 0;                 // format() to cout
 
-                virtual void set_row_label() = 0;
-                virtual void set_column_label() = 0;
-                virtual void set_column_keys(std::string* keys) = 0;
+                virtual void set_title(const std::string& title) = 0;
+                virtual void set_row_label(const std::string& label) = 0;
+                virtual void set_column_label(const std::string& label) = 0;
+                virtual void set_column_keys(const std::vector<std::string>& keys) = 0;
                 virtual void set_uniform_width(int width = 0) = 0;      // width = 0 => auto pick width
-                virtual void set_formatter(/* functionPointer */) = 0;
+                virtual void set_formatter(Formatter formatter) = 0;
 };
 
-
+// Cells are rendered by the formatter (by default, operator<< with the
+// stream's default precision) and right aligned. A row with fewer data than
+// there are column keys leaves the rest of its cells blank (empty in CSV,
+// null in JSON). Definitions live in tabler.cpp, which instantiates Tabler
+// for double, long long and std::string.
+//      Example usage:
+//          Tabler<double> table("m/n", "k");
+//          table.set_column_keys(keys);    // "1", "2", "3"
+//          for(int lenfact = 3; lenfact < 8; ++lenfact)
+//          {
+//                  Row<double>& row = table.add_row(std::to_string(lenfact));
+//                  for(int hashcount = 1; hashcount <= 3; ++hashcount)
+//                          row.add_data(measure(lenfact, hashcount));
+//          }
+//          table.print();
+//
+//      prints
+//          m/n \ k       1       2       3
+//                3  0.1812  0.1335  0.1201
+//                4  0.1496  0.0912  0.0737
+//              ...
 template <class T>
 class Tabler : public virtual TablerInterface<T>
 {
         public:
-                Tabler();
-                virtual ~Tabler();
-
-                virtual Row<T> add_row(std::string row_key);
-
-                virtual void print();
-                virtual std::string format();    // we'll see after the rest is done
-
-                virtual void set_row_label();
-                virtual void set_column_label();
-                virtual void set_column_keys(std::string* keys);
+                Tabler(const std::string& row_label = "",
+                       const std::string& column_label = "");
+                virtual ~Tabler() {}
+
+                // The returned row stays valid as more rows are added.
+                virtual Row<T>& add_row(const std::string& row_key);
+
+                virtual std::string format() const;
+                virtual std::string format_csv() const;
+                // An object with the title, both labels, the column keys and
+                // the rows. Cells which read as JSON numbers are written as
+                // numbers, others as strings.
+                virtual std::string format_json() const;
+                virtual void print() const;
+
+                virtual void set_title(const std::string& title);   // first line of format()
+                virtual void set_row_label(const std::string& label);     // e.g. m/n
+                virtual void set_column_label(const std::string& label);  // e.g. k
+                virtual void set_column_keys(const std::vector<std::string>& keys);
                 virtual void set_uniform_width(int width = 0);      // width = 0 => auto pick width
-                virtual void set_formatter();
+                virtual void set_formatter(typename TablerInterface<T>::Formatter formatter);
         private:
-                //friend Row<T>* row_list_;
-                Row<T>* row_list_;
-
-                int get_column_width(int column);
+                typedef std::vector<std::vector<std::string> > Cells;
+
+                static std::string default_format(const T& data);
+                int get_column_count() const;
+                std::string get_corner() const;     // "m/n \ k"
+                Cells get_cells() const;            // formatted data, by row
+                int get_column_width(int column, const Cells& cells) const;
+
+                std::deque<Row<T> > rows_;          // deque: add_row() never moves rows
+                std::string title_;
+                std::string row_label_;             // m/n
+                std::string column_label_;          // k
+                std::vector<std::string> column_keys_;  // k = 1, 2, 3, 4, 5, ...
                 bool uniform_width_;
-                bool width_;
-                std::vector<int> widest_in_column_; // as elements are added, check if it's widest against this, and update if it is
-
-                std::string row_label_;     // m/n
-                std::string column_label_;  // k
-                std::string* column_keys_;  // k = 1, 2, 3, 4, 5, ...
-                //DISALLOW_COPY_AND_ASSIGN();
+                int width_;                         // minimum when uniform
+                typename TablerInterface<T>::Formatter formatter_;
+                DISALLOW_COPY_AND_ASSIGN(Tabler);
 };
 
-
-
-template <class T>
-void Tabler<T>::print()
-{
-        // Header formatting      m
-        //                      k x 1 2 3 4 5 k
-        //                        1 . . . . .
-        //                        2 . . . . .
-        //                        m
-        return;
-}
-
-template <class T>
-class Row// : protected Tabler<T>
-{
-        public:
-                Row();
-                ~Row();
-                void add_data(T data);
-};
-
-
-/*
-table = Tabler
-for outerloop
-        row = table.add_row()
-        for innerloop
-                row.add_data(data)
-table.print()
-*/
-
 #endif